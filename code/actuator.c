@@ -7,7 +7,13 @@
 #include "os/dev/leds.h"
 #include "sys/clock.h"
 #include "sys/ctimer.h"
+#include "cfs/cfs.h"
+#include <string.h>
 #include "structures.h"
+#include "sink-cache.h"
+#include "rate-limiter.h"
+#include "timesync.h"
+#include "persist.h"
 
 #define LOG_MODULE "Actuator"
 #define LOG_LEVEL LOG_LEVEL_INFO
@@ -17,7 +23,14 @@
 #define LIGHTS 2	//identifier of lights actuator
 #define NUM_ACTUATOR 3 //number of actuators programmed in the software
 #define DELAY_ALIVE_MESSAGE 10 //delay of rate of the ACK message to the sink
-#define SECRET 123456789 //security key value
+#define REJOIN_PERIOD 1 //delay between two rejoin attempts to the cached sink
+#define REJOIN_MAX_RETRY 2 //number of rejoin attempts before the broadcast registration
+#define MIN_DWELL 30 //minimum time (seconds) between two changes of the same actuator, protects motors and valves whatever the sink asks
+#define COMMAND_BURST 3 //changes of the same actuator that can be done in a row
+#define COMMAND_REFILL 120 //seconds needed to get back one change
+#define SINK_RETRY_PERIOD 10 //delay between two attempts to reconnect to the lost sink
+#define POLICY_FILE "policy" //file where the control policy received from the sink is saved
+#define POLICY_MAGIC 0x504f4c32 //"POL2": layout of the policy (struct threshold), to change with it
 
 struct actuators { //defines the status (on = 1 /off = 0) and if it is functioning
 	bool status; 
@@ -26,24 +39,97 @@ struct actuators { //defines the status (on = 1 /off = 0) and if it is functioni
 };
 static struct actuators elem[NUM_ACTUATOR];
 static struct ctimer timer;
+static struct ctimer limit_timer; //used to act the commands delayed by the limits
+static struct rate_limiter limits[NUM_ACTUATOR];
+static bool requested[NUM_ACTUATOR]; //last state acted for each actuator
+static struct mess_to_actuator desired; //last command received from the sink
+static struct ctimer rejoin_timer; //used while trying to rejoin the cached sink
+static int rejoin_retry;
 
 static bool connected = false; //variable to state if the actuator is connected to the sink node
 static linkaddr_t sink_addr; //here we will save the sink address after the first communication
+static struct sink_cache cache; //last known sink, saved in flash
+static struct link_quality sink_link; //link from the sink to the actuator
+static struct replay_window sink_replay; //frame counters received from the sink
+static unsigned char tx_seq; //sequence number of the next frame sent to the sink
+static struct timesync sink_clock; //estimate of the clock of the sink
 static struct actuator_status info; //this will indicate to the sink the kind of error or the repaired actuator
+static struct ctimer sink_timer; //expires when the sink has been silent for SINK_SILENCE_DEADLINE
+static bool local_control = false; //the sink is lost, the actuator follows the readings of the sensors on its own
+static struct threshold policy[NUM_CHANNELS]; //tresholds used by the local control, pushed by the sink
+static bool policy_valid = false; //a policy has been received (now or before a reset)
 
 PROCESS(actuator_process, "Actuator start");
 AUTOSTART_PROCESSES(&actuator_process);
 
+static void input_callback(const void *data, uint16_t len, const linkaddr_t *src, const linkaddr_t *dest);
+static void sink_lost(void *ptr);
+
 static void register_node(){ //function called for sending the broadcast message to the sink for the first registration
 	struct mess_registration registration;
-	registration.secret = (unsigned int)SECRET; // we give the security to the sink that we are an allowed node
 	registration.t = act;
-	nullnet_buf = (uint8_t *)&registration;
-	nullnet_len = sizeof(registration);
-	NETSTACK_NETWORK.output(NULL); //broadcast message
+	frame_auth_send(&registration, sizeof(registration), NULL); //broadcast message, the MIC tells to the sink that we are an allowed node
 	LOG_INFO("TIMESTAMP: %lu, Sending BROADCAST message to retrieve the Sink address\n", clock_seconds());
 }
 
+static void rejoin_node(void *ptr){ //function called for trying a unicast rejoin to the last known sink, before falling back to the broadcast registration
+	if(connected){
+		return;
+	}
+	if(rejoin_retry == REJOIN_MAX_RETRY){
+		LOG_INFO("TIMESTAMP: %lu, The cached sink does not answer\n", clock_seconds());
+		register_node();
+		return;
+	}
+	struct mess_rejoin rejoin;
+	rejoin.t = act;
+	rejoin.slot = cache.slot;
+	rejoin.seq = tx_seq++;
+	frame_auth_send(&rejoin, sizeof(rejoin), &cache.addr);
+	LOG_INFO("TIMESTAMP: %lu, Sending UNICAST message to rejoin the cached Sink\n", clock_seconds());
+	rejoin_retry++;
+	ctimer_set(&rejoin_timer, CLOCK_SECOND * REJOIN_PERIOD, rejoin_node, NULL);
+}
+
+static void retry_registration(void *ptr){ //the registry of the sink was full, try again by broadcast
+	if(!connected){
+		register_node();
+	}
+}
+
+static bool load_policy(){ //loads the policy saved in flash, false if it has never been received (or has another layout)
+	return persist_load(POLICY_FILE, POLICY_MAGIC, policy, sizeof(policy));
+}
+
+static void save_policy(const struct threshold *thresholds){ //keeps the policy pushed by the sink, the flash is written only if it has changed
+	if(policy_valid && memcmp(policy, thresholds, sizeof(policy)) == 0){
+		return;
+	}
+	memcpy(policy, thresholds, sizeof(policy));
+	policy_valid = true;
+	persist_save(POLICY_FILE, POLICY_MAGIC, policy, sizeof(policy));
+	LOG_INFO("TIMESTAMP: %lu, Received the control policy from the sink\n", clock_seconds());
+}
+
+static void connect_node(bool cached){ //start the connection with the sink: the cached one if any, otherwise by broadcast
+	for(int i = 0; i < NUM_ACTUATOR; i++){
+		elem[i].old = false; //initialize the variable to be sure that it will be false at the beginning
+	}
+	nullnet_set_input_callback(input_callback);
+	tx_seq = 0;
+	link_quality_reset(&sink_link);
+	timesync_reset(&sink_clock);
+	link_quality_max_tx_power(); //the power goes down once the sink reports the quality of the link
+	ctimer_set(&sink_timer, CLOCK_SECOND * SINK_SILENCE_DEADLINE, sink_lost, NULL); //no answer (e.g. reset during an outage): local control and retries
+	if(cached){
+		rejoin_retry = 0;
+		rejoin_node(NULL);
+	}
+	else{
+		register_node();
+	}
+}
+
 static void break_actuator(){ //function called when the right button of the actuator node is pressed, and an actuator breaks
 	bool broken = false;
 	while(!broken){
@@ -89,9 +175,8 @@ static void break_actuator(){ //function called when the right button of the act
 				}
 			}
 			//send the message to the sink to notify the break
-			nullnet_buf = (uint8_t *)&info;
-			nullnet_len = sizeof(info);
-			NETSTACK_NETWORK.output(&sink_addr);
+			info.seq = tx_seq++;
+			frame_auth_send(&info, sizeof(info), &sink_addr);
 		}	
 	}
 }
@@ -133,9 +218,8 @@ static void repair_actuator(){ //function that is called when the left button of
 			}
 		}
 		//send the message to the sink to notify the repair
-		nullnet_buf = (uint8_t *)&info;
-		nullnet_len = sizeof(info);
-		NETSTACK_NETWORK.output(&sink_addr);
+		info.seq = tx_seq++;
+		frame_auth_send(&info, sizeof(info), &sink_addr);
 	}
 }
 
@@ -207,50 +291,205 @@ static void command(struct mess_to_actuator *message){ //function that acts the
 	}		
 }
 
-static void alive(){ //function that sends the ACK to the Sink.
-	unsigned int secret = (unsigned int)SECRET;
-	nullnet_buf = (uint8_t*)&secret; //NULL message to say to the Sink that i'm alive
-	nullnet_len = sizeof(secret);
-	NETSTACK_NETWORK.output(&sink_addr);
+static bool *command_field(struct mess_to_actuator *message, int actuator){ //returns the field of the message that drives an actuator
+	if(actuator == IRRIGATION){
+		return &message->open_irrigation;
+	}
+	if(actuator == WINDOWS){
+		return &message->open_window;
+	}
+	return &message->darken;
+}
+
+static void apply_desired(void *ptr){ //acts the last command of the sink, the changes not allowed yet by the limits are delayed (only the last request is kept)
+	struct mess_to_actuator effective = desired;
+	unsigned long now = clock_seconds();
+	unsigned long retry = 0;
+	bool changed = false;
+	for(int i = 0; i < NUM_ACTUATOR; i++){
+		bool *want = command_field(&effective, i);
+		if(*want == requested[i]){
+			continue;
+		}
+		unsigned long wait = rate_limiter_wait(&limits[i], now, MIN_DWELL, COMMAND_BURST, COMMAND_REFILL);
+		if(wait == 0){
+			rate_limiter_take(&limits[i], now);
+			requested[i] = *want;
+			changed = true;
+		}
+		else{
+			*want = requested[i]; //keep the current state for now
+			if(retry == 0 || wait < retry){
+				retry = wait;
+			}
+		}
+	}
+	if(changed){
+		command(&effective);
+	}
+	if(retry > 0){
+		LOG_INFO("TIMESTAMP: %lu, Command delayed by %lu seconds to protect the actuators\n", clock_seconds(), retry);
+		ctimer_set(&limit_timer, CLOCK_SECOND * retry, apply_desired, NULL);
+	}
+	else{
+		ctimer_stop(&limit_timer);
+	}
+}
+
+static void alive(){ //function that sends the ACK to the Sink, with the commands the actuator is following
+	struct mess_alive message;
+	message.seq = tx_seq++;
+	message.open_window = desired.open_window;
+	message.open_irrigation = desired.open_irrigation;
+	message.darken = desired.darken;
+	message.reserved = 0;
+	frame_auth_send(&message, sizeof(message), &sink_addr); //message to say to the Sink that i'm alive
+	frame_auth_tick();
 	LOG_INFO("TIMESTAMP: %lu, Sent ACK message to the sink to tell that i'm not broken\n", clock_seconds());
 	ctimer_set(&timer, CLOCK_SECOND * DELAY_ALIVE_MESSAGE, alive, NULL); //re-set the timer in order to trigger the next ACK
 }
 
+static void local_check(int value, const struct threshold *th, bool *command, bool above){ //same check of the sink on a channel
+	if(value > th->broken_up || value < th->broken_down){ //the sensor may be broken
+		return;
+	}
+	*command = (value > th->treshold + th->hysteresis) ? above : (value < th->treshold - th->hysteresis) ? !above : *command;
+}
+
+static void local_control_reading(const struct mess_sensor_node *reading){ //closed loop control on a reading overheard while the sink is lost
+	struct mess_to_actuator mess = desired;
+#define LOCAL_RULE(field, command, above, ...) \
+	if((reading->faults & SENSOR_FAULT(field)) == 0){ \
+		local_check(reading->field, &policy[ch_##field], &mess.command, above); \
+	}
+	CONTROL_RULES(LOCAL_RULE)
+#undef LOCAL_RULE
+	desired = mess;
+	apply_desired(NULL); //the limits of the actuators still apply
+}
+
+static void sink_heard(){ //a frame of the sink has been received, it's not lost
+	ctimer_set(&sink_timer, CLOCK_SECOND * SINK_SILENCE_DEADLINE, sink_lost, NULL);
+}
+
+static void sink_lost(void *ptr){ //the sink has been silent for too long: control on our own and try to reconnect until it answers
+	if(connected){
+		connected = false;
+		ctimer_stop(&timer); //no more alive messages until the sink is back
+		link_quality_reset(&sink_link);
+		link_quality_max_tx_power();
+		if(!policy_valid){
+			LOG_WARN("TIMESTAMP: %lu, Sink lost and no control policy received, the actuators keep their state\n", clock_seconds());
+		}
+	}
+	if(policy_valid && !local_control){ //also when the sink has never answered since the reset, with the policy saved in flash
+		local_control = true;
+		LOG_WARN("TIMESTAMP: %lu, Sink lost, local control with the readings of the sensors\n", clock_seconds());
+	}
+	rejoin_retry = 0;
+	rejoin_node(NULL);
+	ctimer_set(&sink_timer, CLOCK_SECOND * SINK_RETRY_PERIOD, sink_lost, NULL);
+}
+
+static bool actuator_handles(uint16_t len, const linkaddr_t *src, const linkaddr_t *dest){ //frames handled by input_callback
+	if(linkaddr_cmp(&linkaddr_null, dest)){ //only the readings broadcast while the sink is lost
+		return local_control && len == sizeof(struct mess_sensor_node);
+	}
+	if(connected){ //the messages of our sink, a late reply to a registration is logged
+		return linkaddr_cmp(src, &sink_addr) && (len == sizeof(struct mess_to_actuator) || len == sizeof(struct mess_link_report) ||
+			len == sizeof(struct mess_policy) || len == sizeof(struct mess_registration_resp));
+	}
+	return len == sizeof(struct mess_registration_resp) || len == sizeof(struct mess_registry_full); //the replies to the registration
+}
+
 static void input_callback(const void *data, uint16_t len, const linkaddr_t *src, const linkaddr_t *dest){ 
+	len = frame_auth_open(data, len, src); //forged, corrupted or replayed frames are dropped before reading them
+	if(len == 0){
+		return;
+	}
+	if(!actuator_handles(len, src, dest)){ //the frames of the other nodes (e.g. their beacons) are not recorded
+		return;
+	}
+	//replayed frames are dropped: the window of the sink, the highest counter received for the others (e.g. the readings of the sensors)
+	if(!frame_auth_fresh(linkaddr_cmp(src, &sink_addr) ? &sink_replay : NULL, src, frame_auth_counter_of(data))){
+		return;
+	}
 	if(linkaddr_cmp(&linkaddr_null, dest) == 0){ //discarding broadcast message
 		LOG_INFO("TIMESTAMP: %lu, Received message, from ", clock_seconds());
 		LOG_INFO_LLADDR(src);
 		LOG_INFO_("\n");			
 		if(connected && linkaddr_cmp(src,&sink_addr)){ //we've already done the first connection with the sink, now it's giving us a command
 			struct mess_to_actuator message = *(struct mess_to_actuator*)data;
-			if(sizeof(struct mess_to_actuator) == len && message.secret == (unsigned int)SECRET){
-				command(&message);
+			if(sizeof(struct mess_to_actuator) == len){
+				sink_heard();
+				link_quality_update(&sink_link, message.seq);
+				timesync_update(&sink_clock, message.clock);
+				desired = message;
+				apply_desired(NULL);
+			}
+			else if(sizeof(struct mess_link_report) == len){ //the sink reports the quality of the link, adapt the transmission power
+				struct mess_link_report *report = (struct mess_link_report*)data;
+				sink_heard();
+				link_quality_update(&sink_link, report->seq);
+				timesync_update(&sink_clock, report->clock);
+				LOG_INFO("TIMESTAMP: %lu, Link to the sink: rssi %d loss %u, from the sink: rssi %d loss %u\n", clock_seconds(), report->rssi, report->loss, link_quality_rssi(&sink_link), sink_link.loss);
+				link_quality_adapt_tx_power(report->rssi, report->loss);
+			}
+			else if(sizeof(struct mess_policy) == len){ //the tresholds to use if the sink is lost
+				struct mess_policy *received = (struct mess_policy*)data;
+				sink_heard();
+				link_quality_update(&sink_link, received->seq);
+				save_policy(received->thresholds);
+			}
+			else if(sizeof(struct mess_registration_resp) == len){ //late or duplicated reply to a rejoin retry, we are already connected
+				LOG_INFO("TIMESTAMP: %lu, Registration reply ignored, already connected\n", clock_seconds());
 			}
 			else{
 				LOG_WARN("TIMESTAMP: %lu: Received message with not consistent data\n", clock_seconds());
 			}
 		}//closing the command from the sink		
-		else if (!connected && len == sizeof((unsigned int)SECRET)){ //first approach between sink and actuator, the sink is answering
-			unsigned int secret_sink = *(unsigned int*)data;
-			if(secret_sink == (unsigned int)SECRET){
-				sink_addr = *src;
-				LOG_INFO("TIMESTAMP: %lu, Received message from the SINK, connected to ", clock_seconds());
-				LOG_INFO_LLADDR(&sink_addr);
-				LOG_INFO_("\n");
-				ctimer_set(&timer, CLOCK_SECOND * DELAY_ALIVE_MESSAGE, alive, NULL); //start the ctimer for ACK message (i'm alive) to the sink
-				connected = true;
+		else if (!connected && len == sizeof(struct mess_registration_resp)){ //first approach between sink and actuator, the sink is answering
+			struct mess_registration_resp resp = *(struct mess_registration_resp*)data;
+			if(!linkaddr_cmp(&sink_addr, src)){ //new sink: its window starts from the highest counter ever received from it
+				replay_window_start(&sink_replay, src);
 			}
-			else{
-				LOG_WARN("TIMESTAMP: %lu: A not allowed node has tried to register\n", clock_seconds());
+			sink_addr = *src;
+			ctimer_stop(&rejoin_timer);
+			sink_cache_save(&cache, &sink_addr, resp.slot);
+			timesync_update(&sink_clock, resp.clock);
+			LOG_INFO("TIMESTAMP: %lu, Received message from the SINK, connected to ", clock_seconds());
+			LOG_INFO_LLADDR(&sink_addr);
+			LOG_INFO_("\n");
+			connected = true;
+			sink_heard();
+			if(local_control){ //the sink goes on from the commands decided locally, that it receives with the alive
+				local_control = false;
+				LOG_INFO("TIMESTAMP: %lu, Sink is back, control handed back to the sink\n", clock_seconds());
 			}
+			alive(); //tells the sink the commands we are following, and starts the ctimer for the ACK message (i'm alive)
 		}//closing the first response
+		else if(!connected && len == sizeof(struct mess_registry_full)){ //another actuator is registered to the sink
+			struct mess_registry_full *full = (struct mess_registry_full*)data;
+			LOG_WARN("TIMESTAMP: %lu, The sink has already an actuator, retry after %u seconds\n", clock_seconds(), full->retry_after);
+			ctimer_set(&rejoin_timer, CLOCK_SECOND * full->retry_after, retry_registration, NULL); //the actuator doesn't beacon: ask again when there may be space
+		}
 	}//closing not broadcast message
+	else if(local_control && len == sizeof(struct mess_sensor_node)){ //reading broadcast by a sensor that has lost the sink too
+		local_control_reading((const struct mess_sensor_node*)data);
+	}
 }//closing function
 
 PROCESS_THREAD(actuator_process, ev, data){
 	PROCESS_BEGIN();
     	LOG_INFO("TIMESTAMP: %lu, Actuator node is ON. Press the RIGHT button to start the connection with the sink\n", clock_seconds());
-		info.secret = (unsigned int)SECRET;
+		frame_auth_init();
+		for(int i = 0; i < NUM_ACTUATOR; i++){
+			rate_limiter_init(&limits[i], COMMAND_BURST, clock_seconds());
+		}
+		policy_valid = load_policy();
+		if(sink_cache_load(&cache)){ //after a reset, rejoin the last known sink without waiting for the button
+			connect_node(true);
+		}
 		while(1){
 			PROCESS_YIELD();
 			//after this call we are sure that an event has occurred	
@@ -258,11 +497,8 @@ PROCESS_THREAD(actuator_process, ev, data){
 				button_hal_button_t *btn = (button_hal_button_t *)data;
 				if(btn->unique_id == BOARD_BUTTON_HAL_INDEX_KEY_RIGHT){ //right button, an attuator breaks. Or if the sink is not connected, start the conversation
 					if(!connected){
-						for(int i = 0; i < NUM_ACTUATOR; i++){
-							elem[i].old = false; //initialize the variable to be sure that it will be false at the beginning
-						}
-						nullnet_set_input_callback(input_callback);
-						register_node();
+						ctimer_stop(&rejoin_timer);
+						connect_node(false);
 					}
 					else if (!(elem[IRRIGATION].broken && elem[WINDOWS].broken && elem[LIGHTS].broken)){ //if they are already dead (everyone) do nothing
 						break_actuator();
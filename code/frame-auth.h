@@ -0,0 +1,281 @@
+#ifndef FRAME_AUTH_H_
+#define FRAME_AUTH_H_
+
+/*
+	Authentication of the frames with CCM* (AES-128): every frame carries in its first field (counter)
+	the frame counter of the sender and ends with a MIC of FRAME_AUTH_MIC_LEN bytes computed on the whole frame.
+	The nonce is made of the address of the sender and of the counter, so a frame can't be replayed
+	by another node. The receiver keeps a replay window for each sender it is talking to (e.g. the registry of the sink),
+	and remembers in flash the highest counter received from the last FRAME_AUTH_SENDERS senders:
+	a frame of a sender without a window is accepted only if its counter is above that one.
+	The senders with a window are never replaced by the others. A sender that has been replaced
+	is unknown again: the counters of the unknown senders must reach the highest one replaced so far.
+	CCM_STAR uses the AES_128 driver of the platform: the crypto engine on the CC26xx (see project-conf.h),
+	the software AES on the others (e.g. native).
+	The frames are only authenticated, not encrypted.
+*/
+
+#include "contiki.h"
+#include "net/linkaddr.h"
+#include "net/netstack.h"
+#include "net/nullnet/nullnet.h"
+#include "lib/ccm-star.h"
+#include "cfs/cfs.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FRAME_AUTH_MIC_LEN 4	// bytes of the MIC at the end of each frame
+#define FRAME_AUTH_COUNTER_BLOCK 256	// frame counters reserved in flash at a time
+#define FRAME_AUTH_COUNTER_FILE "frame_counter"
+#define FRAME_AUTH_SENDERS_FILE "senders"
+#define FRAME_AUTH_SENDERS_MAGIC 0x53445232	// "SDR2": layout of FRAME_AUTH_SENDERS_FILE
+#define FRAME_AUTH_SAVE_PERIOD 300	// (seconds) minimum time between two saves of the counters of the senders
+
+#ifndef FRAME_AUTH_MAX_PAYLOAD
+#define FRAME_AUTH_MAX_PAYLOAD 64	// biggest message that can be sent
+#endif
+
+#ifndef FRAME_AUTH_SENDERS
+#define FRAME_AUTH_SENDERS 8	// senders whose highest counter is remembered, the one not heard for the longest time is replaced
+#endif
+
+// Key shared by the nodes of the network: must be changed for each deployment
+#ifndef FRAME_AUTH_KEY
+#define FRAME_AUTH_KEY { 0x4f, 0x72, 0x63, 0x68, 0x61, 0x72, 0x64, 0x2d, 0x6e, 0x65, 0x74, 0x2d, 0x6b, 0x65, 0x79, 0x31 }
+#endif
+
+// Counters of the frames already received from a sender
+struct replay_window {
+	uint32_t last;	// highest counter received
+	uint32_t bitmap;	// bit i -> counter last - i has been received
+	bool valid;
+};
+
+// Highest counter received from a sender
+struct sender_counter {
+	linkaddr_t addr;
+	uint32_t counter;
+	unsigned long seen;	// clock_seconds() of its last frame
+	bool pinned;	// the receiver keeps a window for it (e.g. a node of the registry)
+};
+
+// Content of FRAME_AUTH_SENDERS_FILE
+struct sender_file {
+	uint32_t magic;
+	uint32_t used;
+	uint32_t floor;	// lowest counter accepted from an unknown sender
+	struct sender_counter senders[FRAME_AUTH_SENDERS];
+};
+
+static const uint8_t frame_auth_key[16] = FRAME_AUTH_KEY;
+static uint32_t frame_auth_counter;	// counter of the next frame sent
+static uint8_t frame_auth_buf[FRAME_AUTH_MAX_PAYLOAD + FRAME_AUTH_MIC_LEN];
+static struct sender_file frame_auth_senders;
+static bool frame_auth_senders_dirty;	// counters not yet saved
+static unsigned long frame_auth_senders_saved;	// clock_seconds() of the last save
+
+/*
+	Counter of the first frame that can be sent after a reset: the counters are never used twice.
+	Loads the counters of the senders, a file with another layout is ignored
+*/
+static void frame_auth_init() {
+	uint32_t saved = 0;
+	int fd = cfs_open(FRAME_AUTH_COUNTER_FILE, CFS_READ);
+	if(fd >= 0) {
+		if(cfs_read(fd, &saved, sizeof(saved)) != sizeof(saved))
+			saved = 0;
+		cfs_close(fd);
+	}
+	frame_auth_counter = saved;
+	fd = cfs_open(FRAME_AUTH_SENDERS_FILE, CFS_READ);
+	if(fd >= 0) {
+		uint8_t extra;
+		int n = cfs_read(fd, &frame_auth_senders, sizeof(frame_auth_senders));
+		if(n != sizeof(frame_auth_senders) || cfs_read(fd, &extra, 1) > 0 ||
+			frame_auth_senders.magic != FRAME_AUTH_SENDERS_MAGIC || frame_auth_senders.used > FRAME_AUTH_SENDERS)
+			frame_auth_senders.used = frame_auth_senders.floor = 0;
+		cfs_close(fd);
+	}
+	// The times of the last frames belong to the clock before the reset
+	for(int i = 0; i < frame_auth_senders.used; i++)
+		frame_auth_senders.senders[i].seen = 0;
+}
+
+/*
+	Periodic work of the node (e.g. at each report): saves the counters of the senders if they have changed,
+	at most every FRAME_AUTH_SAVE_PERIOD seconds, so that their old frames are still dropped after a reset
+*/
+static void frame_auth_tick() {
+	int fd;
+	if(frame_auth_senders_dirty == false || clock_seconds() - frame_auth_senders_saved < FRAME_AUTH_SAVE_PERIOD)
+		return;
+	frame_auth_senders.magic = FRAME_AUTH_SENDERS_MAGIC;
+	fd = cfs_open(FRAME_AUTH_SENDERS_FILE, CFS_WRITE);
+	if(fd < 0)
+		return;
+	cfs_write(fd, &frame_auth_senders, sizeof(frame_auth_senders));
+	cfs_close(fd);
+	frame_auth_senders_dirty = false;
+	frame_auth_senders_saved = clock_seconds();
+}
+
+static struct sender_counter *frame_auth_sender(const linkaddr_t *src) {
+	for(int i = 0; i < frame_auth_senders.used; i++) {
+		if(linkaddr_cmp(&frame_auth_senders.senders[i].addr, src))
+			return &frame_auth_senders.senders[i];
+	}
+	return NULL;
+}
+
+/*
+	Records the counter of a frame accepted from a sender. A new sender replaces the one not heard for the longest time,
+	among the ones without a window if any: the counters up to the replaced one are no longer accepted from the unknown senders
+*/
+static void frame_auth_remember(const linkaddr_t *src, uint32_t counter, bool pinned) {
+	struct sender_counter *s = frame_auth_sender(src);
+	if(s == NULL) {
+		if(frame_auth_senders.used < FRAME_AUTH_SENDERS) {
+			s = &frame_auth_senders.senders[frame_auth_senders.used++];
+		} else {
+			s = &frame_auth_senders.senders[0];
+			for(int i = 1; i < FRAME_AUTH_SENDERS; i++) {
+				struct sender_counter *c = &frame_auth_senders.senders[i];
+				if((s->pinned && c->pinned == false) || (s->pinned == c->pinned && c->seen < s->seen))
+					s = c;
+			}
+			if(s->counter >= frame_auth_senders.floor)
+				frame_auth_senders.floor = s->counter + 1;
+		}
+		s->addr = *src;
+		s->counter = counter;
+	} else if(counter > s->counter) {
+		s->counter = counter;
+	}
+	s->seen = clock_seconds();
+	s->pinned = pinned;
+	frame_auth_senders_dirty = true;
+}
+
+// Saves in flash the end of the block of counters that is being used
+static void frame_auth_reserve() {
+	uint32_t reserved = frame_auth_counter + FRAME_AUTH_COUNTER_BLOCK;
+	int fd = cfs_open(FRAME_AUTH_COUNTER_FILE, CFS_WRITE);
+	if(fd >= 0) {
+		cfs_write(fd, &reserved, sizeof(reserved));
+		cfs_close(fd);
+	}
+}
+
+static void frame_auth_nonce(uint8_t *nonce, const linkaddr_t *sender, uint32_t counter) {
+	memset(nonce, 0, CCM_STAR_NONCE_LENGTH);
+	memcpy(nonce, sender->u8, LINKADDR_SIZE < 8 ? LINKADDR_SIZE : 8);
+	nonce[8] = counter >> 24;
+	nonce[9] = counter >> 16;
+	nonce[10] = counter >> 8;
+	nonce[11] = counter;
+	nonce[12] = FRAME_AUTH_MIC_LEN;
+}
+
+static void frame_auth_mic(const uint8_t *frame, uint16_t len, const linkaddr_t *sender, uint32_t counter, uint8_t *mic) {
+	uint8_t nonce[CCM_STAR_NONCE_LENGTH];
+	frame_auth_nonce(nonce, sender, counter);
+	CCM_STAR.set_key(frame_auth_key);
+	CCM_STAR.aead(nonce, NULL, 0, frame, len, mic, FRAME_AUTH_MIC_LEN, 1);
+}
+
+// Counter of a frame that has been accepted by frame_auth_open()
+static uint32_t frame_auth_counter_of(const void *data) {
+	uint32_t counter;
+	memcpy(&counter, data, sizeof(counter));
+	return counter;
+}
+
+// Sends a message (dest NULL -> broadcast): writes the counter in its first field and appends the MIC
+static void frame_auth_send(const void *payload, uint16_t len, const linkaddr_t *dest) {
+	if(len < sizeof(uint32_t) || len > FRAME_AUTH_MAX_PAYLOAD)
+		return;
+	if(frame_auth_counter % FRAME_AUTH_COUNTER_BLOCK == 0)
+		frame_auth_reserve();
+	memcpy(frame_auth_buf, payload, len);
+	memcpy(frame_auth_buf, &frame_auth_counter, sizeof(frame_auth_counter));
+	frame_auth_mic(frame_auth_buf, len, &linkaddr_node_addr, frame_auth_counter, frame_auth_buf + len);
+	frame_auth_counter++;
+	nullnet_buf = frame_auth_buf;
+	nullnet_len = len + FRAME_AUTH_MIC_LEN;
+	NETSTACK_NETWORK.output(dest);
+}
+
+/*
+	Checks the MIC of a received frame. Returns the length of the message without the MIC, 0 if the frame
+	must be dropped. Nothing of the frame is read before the check, and the MIC is compared in constant time
+*/
+static uint16_t frame_auth_open(const void *data, uint16_t len, const linkaddr_t *src) {
+	uint8_t mic[FRAME_AUTH_MIC_LEN];
+	uint8_t diff = 0;
+	if(data == NULL || len < sizeof(uint32_t) + FRAME_AUTH_MIC_LEN || len > FRAME_AUTH_MAX_PAYLOAD + FRAME_AUTH_MIC_LEN)
+		return 0;
+	len -= FRAME_AUTH_MIC_LEN;
+	frame_auth_mic(data, len, src, frame_auth_counter_of(data), mic);
+	for(int i = 0; i < FRAME_AUTH_MIC_LEN; i++)
+		diff |= mic[i] ^ ((const uint8_t*)data)[len + i];
+	return diff == 0 ? len : 0;
+}
+
+// Starts the window of a sender from the counter of its last frame
+static void replay_window_init(struct replay_window *w, uint32_t counter) {
+	w->last = counter;
+	w->bitmap = 1;
+	w->valid = true;
+}
+
+// Starts the window of a sender from the highest counter ever received from it
+static void replay_window_start(struct replay_window *w, const linkaddr_t *src) {
+	struct sender_counter *s = frame_auth_sender(src);
+	if(s != NULL)
+		replay_window_init(w, s->counter);
+	else
+		w->valid = false;
+}
+
+// Returns false if the frame has already been received (or is too old), otherwise records it
+static bool replay_window_check(struct replay_window *w, uint32_t counter) {
+	if(w->valid == false) {
+		replay_window_init(w, counter);
+		return true;
+	}
+	if(counter > w->last) {
+		uint32_t shift = counter - w->last;
+		w->bitmap = (shift >= 32) ? 1 : (w->bitmap << shift) | 1;
+		w->last = counter;
+		return true;
+	}
+	uint32_t age = w->last - counter;
+	if(age >= 32 || (w->bitmap & ((uint32_t)1 << age)))
+		return false;
+	w->bitmap |= (uint32_t)1 << age;
+	return true;
+}
+
+/*
+	Replay check of an authenticated frame: against the window of the sender (w not NULL),
+	otherwise its counter must be above the highest one received from the sender (or reach the floor if it is unknown).
+	Returns false if the frame must be dropped, otherwise records its counter: to be called only for the frames
+	the node handles, so that the others (e.g. the beacons of other nodes) don't take the place of its peers
+*/
+static bool frame_auth_fresh(struct replay_window *w, const linkaddr_t *src, uint32_t counter) {
+	if(w != NULL && w->valid) {
+		if(replay_window_check(w, counter) == false)
+			return false;
+	} else {
+		struct sender_counter *s = frame_auth_sender(src);
+		if(s != NULL ? counter <= s->counter : counter < frame_auth_senders.floor)
+			return false;
+		if(w != NULL)
+			replay_window_init(w, counter);
+	}
+	frame_auth_remember(src, counter, w != NULL);
+	return true;
+}
+
+#endif /* FRAME_AUTH_H_ */
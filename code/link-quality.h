@@ -0,0 +1,92 @@
+#ifndef LINK_QUALITY_H_
+#define LINK_QUALITY_H_
+
+/*
+	Quality of the link with a neighbour: EWMA of the RSSI and of the lost frames,
+	estimated from the gaps in the sequence numbers.
+	Used by every node, and by sensors and actuators to adapt their transmission power.
+*/
+
+#include "net/netstack.h"
+#include "net/packetbuf.h"
+#include <stdbool.h>
+
+#define LQ_WEIGHT 8	// EWMA weight of the new sample is 1/LQ_WEIGHT
+#define LQ_MAX_GAP 32	// bigger gaps are duplicated frames or a reset of the neighbour
+
+// transmission power adaptation
+#define LINK_RSSI_FLOOR -90	// (dBm) RSSI under which the frames start to get lost
+#define LINK_MARGIN 10	// (dB) margin to keep over LINK_RSSI_FLOOR
+#define LINK_LOSS_HIGH 10	// (%) losses that make the power go up
+#define LINK_LOSS_LOW 2	// (%) losses that allow the power to go down
+#define TX_POWER_STEP 3	// (dBm)
+
+struct link_quality {
+	int16_t rssi;	// EWMA of the RSSI, in 1/LQ_WEIGHT dBm
+	unsigned char loss;	// EWMA of the lost frames (percent)
+	unsigned char last_seq;	// sequence number of the last frame received
+	bool valid;	// at least a frame has been received
+};
+
+// Forgets the link (e.g. the neighbour has been registered again)
+static void link_quality_reset(struct link_quality *lq) {
+	lq->valid = false;
+	lq->rssi = 0;
+	lq->loss = 0;
+}
+
+// RSSI of the link in dBm
+static int link_quality_rssi(const struct link_quality *lq) {
+	return lq->rssi / LQ_WEIGHT;
+}
+
+// Updates the link with the frame that is in the packetbuf. Must be called by the input callback
+static void link_quality_update(struct link_quality *lq, unsigned char seq) {
+	int rssi = (int16_t)packetbuf_attr(PACKETBUF_ATTR_RSSI);
+	if(lq->valid == false) {
+		lq->rssi = rssi * LQ_WEIGHT;
+		lq->loss = 0;
+		lq->valid = true;
+	} else {
+		unsigned char gap = seq - lq->last_seq - 1;	// frames lost since the last one
+		if(gap > LQ_MAX_GAP)
+			gap = 0;
+		lq->rssi += rssi - lq->rssi / LQ_WEIGHT;
+		lq->loss = (lq->loss * (LQ_WEIGHT - 1) + 100 * gap / (gap + 1)) / LQ_WEIGHT;
+	}
+	lq->last_seq = seq;
+}
+
+// Sets the maximum transmission power (used while looking for the sink)
+static inline void link_quality_max_tx_power() {
+	radio_value_t max;
+	if(NETSTACK_RADIO.get_value(RADIO_CONST_TXPOWER_MAX, &max) == RADIO_RESULT_OK)
+		NETSTACK_RADIO.set_value(RADIO_PARAM_TXPOWER, max);
+}
+
+/*
+	Adapts the transmission power to the link seen by the receiver (RSSI in dBm and losses in percent):
+	goes up when the losses climb or the margin is too small, goes down while the margin allows it
+*/
+static inline void link_quality_adapt_tx_power(int rssi, unsigned char loss) {
+	radio_value_t power, min, max;
+	int margin = rssi - LINK_RSSI_FLOOR;
+	if(NETSTACK_RADIO.get_value(RADIO_PARAM_TXPOWER, &power) != RADIO_RESULT_OK ||
+		NETSTACK_RADIO.get_value(RADIO_CONST_TXPOWER_MIN, &min) != RADIO_RESULT_OK ||
+		NETSTACK_RADIO.get_value(RADIO_CONST_TXPOWER_MAX, &max) != RADIO_RESULT_OK)
+		return;
+	if(loss > LINK_LOSS_HIGH || margin < LINK_MARGIN) {
+		if(power >= max)
+			return;
+		power = (power + TX_POWER_STEP > max) ? max : power + TX_POWER_STEP;
+	} else if(loss <= LINK_LOSS_LOW && margin > LINK_MARGIN + TX_POWER_STEP) {
+		if(power <= min)
+			return;
+		power = (power - TX_POWER_STEP < min) ? min : power - TX_POWER_STEP;
+	} else {
+		return;
+	}
+	NETSTACK_RADIO.set_value(RADIO_PARAM_TXPOWER, power);
+}
+
+#endif /* LINK_QUALITY_H_ */
@@ -0,0 +1,47 @@
+#ifndef PERSIST_H_
+#define PERSIST_H_
+
+/*
+	Structures saved in flash with a header: the magic of their layout and their size.
+	A file with another magic or another size (e.g. saved by an older firmware) is rejected,
+	so that the caller falls back to its defaults instead of reading garbage.
+	The magic must be changed whenever the layout of the structure changes.
+*/
+
+#include "cfs/cfs.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+struct persist_header {
+	uint32_t magic;
+	uint32_t size;
+};
+
+// Loads a structure saved by persist_save(). Returns false if the file is missing or has another layout
+static bool persist_load(const char *file, uint32_t magic, void *data, uint32_t size) {
+	struct persist_header header;
+	uint8_t extra;
+	bool ok;
+	int fd = cfs_open(file, CFS_READ);
+	if(fd < 0)
+		return false;
+	ok = cfs_read(fd, &header, sizeof(header)) == sizeof(header) && header.magic == magic && header.size == size &&
+		cfs_read(fd, data, size) == (int)size && cfs_read(fd, &extra, 1) <= 0;
+	cfs_close(fd);
+	return ok;
+}
+
+static bool persist_save(const char *file, uint32_t magic, const void *data, uint32_t size) {
+	struct persist_header header = { magic, size };
+	bool ok;
+	int fd;
+	cfs_remove(file);	// a longer file saved before would leave its tail
+	fd = cfs_open(file, CFS_WRITE);
+	if(fd < 0)
+		return false;
+	ok = cfs_write(fd, &header, sizeof(header)) == sizeof(header) && cfs_write(fd, data, size) == (int)size;
+	cfs_close(fd);
+	return ok;
+}
+
+#endif /* PERSIST_H_ */
@@ -0,0 +1,34 @@
+#ifndef PROJECT_CONF_H_
+#define PROJECT_CONF_H_
+
+/*
+	Configuration of the project, included by Contiki-NG before its own.
+	Every table of the firmwares is allocated at compile time with the sizes below:
+	tools/footprint.sh reports the RAM and flash used by each module and how many sensor nodes fit in a RAM budget
+*/
+
+// Registry of the sink: one struct sensor_node for each sensor node
+#define MAX_SENSOR_NODES 1
+#define NUM_ZONES 2	// zones of the orchard, each one with its own tresholds
+#define MAX_ZONE_ENTRIES 8	// sensor nodes that can be assigned to a zone different from 0
+#define ADMISSION_ENTRIES 8	// sources whose registrations are tracked by the admission control of the sink
+
+// Netstack: a neighbour for each registered sensor node and the actuator, the frames queued by CSMA
+#define NBR_TABLE_CONF_MAX_NEIGHBORS (MAX_SENSOR_NODES + 1)
+#define QUEUEBUF_CONF_NUM 4
+
+// Biggest message (mess_policy), checked at compile time by structures.h
+#define FRAME_AUTH_MAX_PAYLOAD 32
+// Senders whose highest frame counter is remembered: the registry, the actuator and the sources tracked by the admission control
+#define FRAME_AUTH_SENDERS (MAX_SENSOR_NODES + 1 + ADMISSION_ENTRIES)
+
+/*
+	CCM* of the frames (frame-auth.h): AES-128 of the crypto engine on the CC26xx,
+	the other targets (e.g. native) keep the software AES of lib/aes-128
+*/
+#if CONTIKI_TARGET_CC26X0_CC13X0
+#undef AES_128_CONF
+#define AES_128_CONF cc26xx_aes_128_driver
+#endif
+
+#endif /* PROJECT_CONF_H_ */
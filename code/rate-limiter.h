@@ -0,0 +1,61 @@
+#ifndef RATE_LIMITER_H_
+#define RATE_LIMITER_H_
+
+/*
+	Minimum dwell time and token bucket for the commands of an actuator.
+	Used by the sink before sending a command and by the actuator before acting it.
+*/
+
+#include <stdbool.h>
+
+struct rate_limiter {
+	bool changed;	// the command has changed at least once
+	unsigned long last_change;	// last time (in seconds) the command has changed
+	unsigned int tokens;	// changes that can be done now
+	unsigned long last_refill;	// last time a token has been added
+};
+
+// Initializes the limiter with a full bucket
+static void rate_limiter_init(struct rate_limiter *l, unsigned int burst, unsigned long now) {
+	l->changed = false;
+	l->tokens = burst;
+	l->last_refill = now;
+}
+
+/*
+	Checks if the command can change now.
+	Returns 0 if it can, otherwise the seconds to wait before trying again.
+	dwell: minimum time between two changes
+	burst: size of the bucket
+	period: seconds needed to get a new token, 0 disables the token bucket
+*/
+static unsigned long rate_limiter_wait(struct rate_limiter *l, unsigned long now, unsigned long dwell, unsigned int burst, unsigned long period) {
+	if(period > 0 && l->tokens < burst) {
+		unsigned long new_tokens = (now - l->last_refill) / period;
+		if(new_tokens >= burst - l->tokens) {
+			l->tokens = burst;
+		} else {
+			l->tokens += new_tokens;
+		}
+		l->last_refill += new_tokens * period;
+	}
+	if(l->tokens >= burst) {	// a full bucket doesn't gain tokens
+		l->tokens = burst;
+		l->last_refill = now;
+	}
+	if(l->changed && now - l->last_change < dwell)
+		return dwell - (now - l->last_change);
+	if(period > 0 && l->tokens == 0)
+		return period - (now - l->last_refill);
+	return 0;
+}
+
+// Records a change of the command (rate_limiter_wait() must have returned 0)
+static void rate_limiter_take(struct rate_limiter *l, unsigned long now) {
+	l->changed = true;
+	l->last_change = now;
+	if(l->tokens > 0)
+		l->tokens--;
+}
+
+#endif /* RATE_LIMITER_H_ */
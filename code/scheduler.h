@@ -0,0 +1,105 @@
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+/*
+	Deadline scheduler with a single etimer.
+	Each task has a period and posts its own event when it runs. When the timer expires,
+	every task whose deadline is within SCHEDULER_SLACK runs in the same wakeup, so tasks
+	with unrelated periods share the wakeups instead of waking up the MCU one at a time.
+*/
+
+#include "contiki.h"
+#include "sys/etimer.h"
+#include <stdbool.h>
+
+#ifndef SCHEDULER_SLACK
+#define SCHEDULER_SLACK (CLOCK_SECOND / 2)	// a task can run this much before its deadline
+#endif
+
+struct sched_task {
+	clock_time_t period;	// 0 -> the task is stopped
+	clock_time_t deadline;	// next time the task has to run
+	process_event_t event;	// event posted when the task runs
+	struct process *process;	// process that receives the event
+};
+
+struct scheduler {
+	struct sched_task *tasks;
+	int num_tasks;
+	struct etimer timer;
+	struct process *owner;	// process that receives the timer events and calls scheduler_run()
+};
+
+// a is before b (the clock can wrap)
+#define SCHED_BEFORE(a, b) ((long)((a) - (b)) < 0)
+
+static void scheduler_init(struct scheduler *s, struct sched_task *tasks, int num_tasks, struct process *owner) {
+	s->tasks = tasks;
+	s->num_tasks = num_tasks;
+	s->owner = owner;
+	for(int i = 0; i < num_tasks; i++)
+		tasks[i].period = 0;
+}
+
+// Sets the timer to the first deadline. Can be called from any process
+static void scheduler_update(struct scheduler *s) {
+	clock_time_t now = clock_time();
+	clock_time_t next = 0;
+	bool active = false;
+	for(int i = 0; i < s->num_tasks; i++) {
+		if(s->tasks[i].period == 0)
+			continue;
+		if(!active || SCHED_BEFORE(s->tasks[i].deadline, next))
+			next = s->tasks[i].deadline;
+		active = true;
+	}
+	PROCESS_CONTEXT_BEGIN(s->owner);
+	if(!active)
+		etimer_stop(&s->timer);
+	else
+		etimer_set(&s->timer, SCHED_BEFORE(now, next) ? next - now : 0);
+	PROCESS_CONTEXT_END(s->owner);
+}
+
+// Starts a task (or changes its period): it runs for the first time after a period
+static void scheduler_start(struct scheduler *s, int task, clock_time_t period) {
+	s->tasks[task].period = period;
+	s->tasks[task].deadline = clock_time() + period;
+	scheduler_update(s);
+}
+
+static void scheduler_stop(struct scheduler *s, int task) {
+	s->tasks[task].period = 0;
+	scheduler_update(s);
+}
+
+// Changes the period of a running task keeping its last run, without touching the other tasks
+static void scheduler_set_period(struct scheduler *s, int task, clock_time_t period) {
+	struct sched_task *t = &s->tasks[task];
+	if(t->period == 0)
+		return;
+	t->deadline = t->deadline - t->period + period;
+	t->period = period;
+	scheduler_update(s);
+}
+
+// Must be called by the owner when the timer expires: runs every task that is due within the slack
+static void scheduler_run(struct scheduler *s) {
+	clock_time_t now = clock_time();
+	for(int i = 0; i < s->num_tasks; i++) {
+		struct sched_task *t = &s->tasks[i];
+		if(t->period == 0 || SCHED_BEFORE(now + SCHEDULER_SLACK, t->deadline))
+			continue;
+		process_post(t->process, t->event, NULL);
+		// Keeps the phase of the task, unless it is late by more than a period
+		t->deadline += t->period;
+		if(SCHED_BEFORE(t->deadline, now))
+			t->deadline = now + t->period;
+	}
+	scheduler_update(s);
+}
+
+// The timer of the scheduler has expired
+#define scheduler_expired(s, ev, data) ((ev) == PROCESS_EVENT_TIMER && (data) == &(s)->timer)
+
+#endif /* SCHEDULER_H_ */
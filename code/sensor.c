@@ -14,6 +14,9 @@
 #include "random.h"
 
 #include "structures.h"
+#include "sink-cache.h"
+#include "scheduler.h"
+#include "timesync.h"
 
 #define LOG_MODULE "Sensor"
 #define LOG_LEVEL LOG_LEVEL_DBG
@@ -29,28 +32,56 @@
 #define SERIAL_STATUS_SET 2
 
 #define BLINKING_PERIOD 0.25
-#define BEACON_PERIOD 1
+#define REJOIN_MAX_RETRY 2 //unicast attempts to the cached sink before the broadcast discovery
+#define MEDIAN_SAMPLES 3 //samples of the median filter that removes the spikes
 
 struct mean{
-	int samples;
-	int value;
+	int16_t value; //same size of the field of mess_sensor_node
+	uint8_t samples; //saturates at 255, then each new sample weights 1/256
+};
+
+//Local fault detection of a channel
+struct filter{
+	int16_t window[MEDIAN_SAMPLES]; //last valid samples
+	uint8_t count; //samples in the window
+	uint8_t next; //position of the next sample in the window
+	uint8_t same; //equal samples in a row
+	bool outOfRange;
+	bool stuck;
 };
 
 static int samplingPeriod = 2;
 static int reportingPeriod = 9;
 static int beaconMaxRetry = 5;
+static int beaconActualRetry;
 
-static struct mean valuesArray[4];
+static struct mean valuesArray[NUM_SENSOR_CHANNELS];
+static struct filter filters[NUM_SENSOR_CHANNELS];
+static unsigned char faults; //Faulty channels (SENSOR_FAULT bits)
 static int valueIndex = 0;
 
-static unsigned int secret = 123456789;
 
-static struct ctimer collectingTimer; //Collecting data
-static struct ctimer reportingTimer; //Sending a msg. with data
-static struct etimer beaconTimer; //Used in registration phase
-static struct etimer ledTimer; //Led blinking timer
+//Tasks of the node, all driven by a single scheduler (one etimer) so that they share the wakeups
+#define TASK_SAMPLE 0 //Collecting data
+#define TASK_REPORT 1 //Sending a msg. with data
+#define TASK_BEACON 2 //Used in registration phase
+#define TASK_BLINK 3 //Led blinking
+#define NUM_TASKS 4
+
+static struct sched_task tasks[NUM_TASKS];
+static struct scheduler scheduler;
 	
 static linkaddr_t sinkAddress;
+static struct sink_cache sinkCache; //Last known sink, saved in flash
+static bool sinkCached;
+static bool rejoining; //True while trying the unicast rejoin to the cached sink
+static struct link_quality sinkLink; //Link from the sink to this node
+static struct replay_window sinkReplay; //Frame counters received from the sink
+static unsigned char txSeq; //Sequence number of the next frame sent to the sink
+static struct timesync sinkClock; //Estimate of the clock of the sink
+static clock_time_t lastSampleTime; //Local time of the last sample
+static clock_time_t lastSinkFrame; //Local time of the last frame received from the sink
+static unsigned short configVersion; //Version of the configuration spread by the sink (0 -> never received)
 static volatile int status;
 static int serialStatus;
 static int serialDevice;//Which timer to update
@@ -59,67 +90,175 @@ PROCESS(main_process, "Main process");
 PROCESS(ui_process, "UI process");
 AUTOSTART_PROCESSES(&main_process, &ui_process);
 
-//Compute the mean of a value with random samples
-static void getValue(void *ptr){
-	int newSample = random_rand() % 5;
-	struct mean *pointer = (struct mean*)ptr;
-	pointer->value = (pointer->value * pointer->samples + newSample) / (pointer->samples + 1);
-	pointer->samples++;
+static void sendMessage(void *payload, int length, linkaddr_t *address){
+	/*
+	printf("len: %d\n", length);
+	for(int i=0; i<length; i++){
+		printf("%x\n", *(char *)(payload + i));
+	}
+	*/
+	frame_auth_send(payload, length, address);
+	LOG_DBG("Invio messaggio. len: %d\n", nullnet_len);
+}
+
+//Random sample
+static int getValue(){
+	return random_rand() % 5;
+}
+
+//Battery sample
+static int getValueBat(){
+	return batmon_sensor.value(BATMON_SENSOR_TYPE_VOLT);
 }
 
-//Add random value to battery value
-static void getValueBat(void *ptr){
-	int newSample = batmon_sensor.value(BATMON_SENSOR_TYPE_VOLT);
-	struct mean *pointer = (struct mean*)ptr;
+//Compute the mean of a value with a new sample
+static void addSample(struct mean *pointer, int newSample){
 	pointer->value = (pointer->value * pointer->samples + newSample) / (pointer->samples + 1);
-	pointer->samples++;
+	if(pointer->samples < UINT8_MAX){
+		pointer->samples++;
+	}
+}
+
+//Median of the samples in the window of the filter
+static int median(struct filter *f){
+	int sorted[MEDIAN_SAMPLES];
+	int i, j;
+	for(i = 0; i < f->count; i++){ //insertion sort, the window is small
+		int v = f->window[i];
+		for(j = i; j > 0 && sorted[j - 1] > v; j--){
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = v;
+	}
+	return sorted[f->count / 2];
+}
+
+/*
+	Checks a new sample of a channel: samples out of [min, max] are discarded, stuckLimit equal samples
+	in a row mean that the sensor is stuck, the spikes are removed by a median filter before the mean
+*/
+static void filterSample(int channel, int sample, int min, int max, int stuckLimit){
+	struct filter *f = &filters[channel];
+	f->outOfRange = (sample < min) || (sample > max);
+	if(f->outOfRange){
+		return;
+	}
+	if(f->count > 0 && sample == f->window[(f->next + MEDIAN_SAMPLES - 1) % MEDIAN_SAMPLES]){
+		if(f->same < UINT8_MAX){
+			f->same++;
+		}
+	}
+	else{
+		f->same = 0;
+	}
+	f->stuck = (stuckLimit > 0) && (f->same >= stuckLimit);
+	f->window[f->next] = sample;
+	f->next = (f->next + 1) % MEDIAN_SAMPLES;
+	if(f->count < MEDIAN_SAMPLES){
+		f->count++;
+	}
+	addSample(&valuesArray[channel], median(f));
 }
 
 //Get the values for all sensors
 static void getSamples(void *ptr){
-	struct mean *valuesArray = (struct mean*)ptr;
-	getValue(&valuesArray[0]);
-	getValue(&valuesArray[1]);
-	getValue(&valuesArray[2]);
-	getValueBat(&valuesArray[3]);
-	process_poll(&main_process);
+	unsigned char newFaults = 0;
+	//One call for each channel of SENSOR_CHANNELS, expanded at compile time
+#define SAMPLE_CHANNEL(field, label, sample, min, max, stuckLimit) \
+	filterSample(sensor_##field, sample(), min, max, stuckLimit); \
+	if(filters[sensor_##field].outOfRange || filters[sensor_##field].stuck){ \
+		newFaults |= SENSOR_FAULT(field); \
+	}
+	SENSOR_CHANNELS(SAMPLE_CHANNEL)
+#undef SAMPLE_CHANNEL
+	lastSampleTime = clock_time();
+	//The sink is told only when the faulty channels change
+	if(newFaults != faults){
+		faults = newFaults;
+		LOG_DBG("Faulty channels: %x\n", faults);
+		if(status == STATUS_REGISTERED){
+			struct mess_sensor_fault faultMessage = {0, faults, txSeq++};
+			sendMessage(&faultMessage, sizeof(faultMessage), &sinkAddress);
+		}
+	}
 }
 
-//Reporting timer is expired, poll the process (do nothing here because local values are involved)
-static void makeReport(void *ptr){
-	process_poll(&main_process);
+//Send a beacon: unicast rejoin to the cached sink, broadcast registration otherwise
+static void sendBeacon(){
+	if(rejoining){
+		struct mess_rejoin rejoinMessage = {0, s_node, sinkCache.slot, txSeq++};
+		sendMessage(&rejoinMessage, sizeof(rejoinMessage), &sinkCache.addr);
+	}
+	else{
+		struct mess_registration beaconMessage = {0, s_node};
+		sendMessage(&beaconMessage, sizeof(beaconMessage), NULL);
+	}
 }
 
-static void sendMessage(void *payload, int length, linkaddr_t *address){
-	/*
-	printf("len: %d\n", length);
-	for(int i=0; i<length; i++){
-		printf("%x\n", *(char *)(payload + i));
-	}
-	*/
-	nullnet_buf = (uint8_t *)payload;
-	nullnet_len = length;
-	NETSTACK_NETWORK.output(address);
-	LOG_DBG("Invio messaggio. len: %d\n", nullnet_len);
+//Start looking for the sink
+static void startConnection(){
+	status = STATUS_CONNECTING;
+	process_poll(&ui_process);
+	beaconActualRetry = 0;
+	rejoining = sinkCached;
+	txSeq = 0;
+	link_quality_reset(&sinkLink);
+	timesync_reset(&sinkClock);
+	link_quality_max_tx_power(); //The power goes down once the sink reports the quality of the link
+	sendBeacon();
+	scheduler_start(&scheduler, TASK_BEACON, CLOCK_SECOND * BEACON_PERIOD);
+	scheduler_start(&scheduler, TASK_BLINK, CLOCK_SECOND * BLINKING_PERIOD);
+}
+
+//No frames from the sink for SINK_SILENCE_DEADLINE: the readings are broadcast, so that the actuator can hear them
+static bool sinkLost(){
+	return clock_time() - lastSinkFrame > CLOCK_SECOND * SINK_SILENCE_DEADLINE;
 }
 
-static void activateSensors(){//and set timers
-	ctimer_set(&reportingTimer, CLOCK_SECOND * reportingPeriod, makeReport, NULL);
-	ctimer_set(&collectingTimer, CLOCK_SECOND * samplingPeriod, getSamples, &valuesArray);
+//Stop looking for the sink
+static void stopConnection(){
+	scheduler_stop(&scheduler, TASK_BEACON);
+	scheduler_stop(&scheduler, TASK_BLINK);
+}
+
+static void activateSensors(){//and start the tasks
+	scheduler_start(&scheduler, TASK_REPORT, CLOCK_SECOND * reportingPeriod);
+	scheduler_start(&scheduler, TASK_SAMPLE, CLOCK_SECOND * samplingPeriod);
 	SENSORS_ACTIVATE(batmon_sensor);
 }
 
-static void deactivateSensors(){//and stop timers
-	ctimer_stop(&reportingTimer);
-	ctimer_stop(&collectingTimer);
+static void deactivateSensors(){//and stop the tasks
+	scheduler_stop(&scheduler, TASK_REPORT);
+	scheduler_stop(&scheduler, TASK_SAMPLE);
 	SENSORS_DEACTIVATE(batmon_sensor);
 }
 
 //Build the structure for the transmission
-static void buildMessage(void *ptr, void *outputBuffer){
+static void buildMessage(void *ptr, struct mess_sensor_node *report){
 	struct mean *valuesArray = (struct mean*)ptr;
-	struct mess_sensor_node MSN = {secret, valuesArray[0].value, valuesArray[1].value, valuesArray[2].value, valuesArray[3].value};
-	memcpy(outputBuffer, &MSN, sizeof(struct mess_sensor_node));
+	struct mess_sensor_node MSN;
+#define PACK_CHANNEL(field, ...) MSN.field = valuesArray[sensor_##field].value;
+	SENSOR_CHANNELS(PACK_CHANNEL)
+#undef PACK_CHANNEL
+	//The window is stamped with the time of its last sample, converted to the timeline of the sink
+	MSN.timestamp = sinkClock.synced ? timesync_to_sink(&sinkClock, lastSampleTime) : 0;
+	MSN.faults = faults; //The values of the faulty channels must not be used by the sink
+	MSN.seq = txSeq++;
+	MSN.config_version = configVersion; //The sink spreads the configuration again if it is old
+	*report = MSN;
+}
+
+//New configuration spread by the sink: the periods change as from the serial line
+static void applyConfig(const struct mess_config *config){
+	if((short)(config->version - configVersion) <= 0){ //Already applied (or older)
+		return;
+	}
+	configVersion = config->version;
+	samplingPeriod = config->sampling;
+	reportingPeriod = config->reporting;
+	scheduler_set_period(&scheduler, TASK_SAMPLE, CLOCK_SECOND * samplingPeriod);
+	scheduler_set_period(&scheduler, TASK_REPORT, CLOCK_SECOND * reportingPeriod);
+	printf("New configuration %u: sampling period %d, reporting period %d\n", configVersion, samplingPeriod, reportingPeriod);
 }
 
 static void inputCallback(const void *data, uint16_t len, const linkaddr_t *src, const linkaddr_t *dest){
@@ -129,23 +268,65 @@ static void inputCallback(const void *data, uint16_t len, const linkaddr_t *src,
 	LOG_DBG("Src %d %d %d %d %d %d %d %d\n", src->u8[0], src->u8[1], src->u8[2], src->u8[3], src->u8[4], src->u8[5], src->u8[6], src->u8[7]);
 	LOG_DBG("Dest %d %d %d %d %d %d %d %d\n", dest->u8[0], dest->u8[1], dest->u8[2], dest->u8[3], dest->u8[4], dest->u8[5], dest->u8[6], dest->u8[7]);
 	*/
-	if(linkaddr_cmp(&linkaddr_node_addr, dest) && (status == STATUS_CONNECTING) && (len == 4) && (*(unsigned int*)data == secret)){
+	//Forged, corrupted or replayed frames are dropped before reading them
+	len = frame_auth_open(data, len, src);
+	if(len == 0){
+		return;
+	}
+	//Only the replies of a sink and the configuration of ours: the frames of the other nodes (e.g. their beacons) are not recorded
+	if(linkaddr_cmp(&linkaddr_node_addr, dest) ? (len != sizeof(struct mess_registration_resp) && len != sizeof(struct mess_registry_full) && len != sizeof(struct mess_link_report))
+		: !(linkaddr_cmp(&linkaddr_null, dest) && linkaddr_cmp(&sinkAddress, src) && len == sizeof(struct mess_config))){
+		return;
+	}
+	//Replayed frames too: the window of the sink, the highest counter ever received for the other senders
+	if(!frame_auth_fresh(linkaddr_cmp(&sinkAddress, src) ? &sinkReplay : NULL, src, frame_auth_counter_of(data))){
+		return;
+	}
+	//Reply to a beacon, or to the readings broadcast while the sink was lost (the sink may have been reset)
+	if(linkaddr_cmp(&linkaddr_node_addr, dest) && (status != STATUS_INACTIVE) && (len == sizeof(struct mess_registration_resp))){
+		struct mess_registration_resp *resp = (struct mess_registration_resp*)data;
+		if(!linkaddr_cmp(&sinkAddress, src)){ //New sink: its window starts from the highest counter ever received from it
+			replay_window_start(&sinkReplay, src);
+		}
 		sinkAddress = *src;
-		status = STATUS_REGISTERED;
-		etimer_stop(&beaconTimer);
-		activateSensors();
-		process_poll(&ui_process);
+		sink_cache_save(&sinkCache, src, resp->slot);
+		sinkCached = true;
+		timesync_update(&sinkClock, resp->clock);
+		lastSinkFrame = clock_time();
+		if(status == STATUS_CONNECTING){
+			status = STATUS_REGISTERED;
+			stopConnection();
+			activateSensors();
+			process_poll(&ui_process);
+		}
+	}
+	//The registry of the sink is full: the beacons start again when it may have space
+	else if(linkaddr_cmp(&linkaddr_node_addr, dest) && (status == STATUS_CONNECTING) && (len == sizeof(struct mess_registry_full))){
+		struct mess_registry_full *full = (struct mess_registry_full*)data;
+		LOG_DBG("Registry of the sink full, retry after %u seconds\n", full->retry_after);
+		beaconActualRetry = 0;
+		scheduler_start(&scheduler, TASK_BEACON, CLOCK_SECOND * full->retry_after);
+	}
+	//The sink reports the quality of the link: adapt the transmission power
+	else if(linkaddr_cmp(&linkaddr_node_addr, dest) && (status == STATUS_REGISTERED) && linkaddr_cmp(&sinkAddress, src) && (len == sizeof(struct mess_link_report))){
+		struct mess_link_report *report = (struct mess_link_report*)data;
+		link_quality_update(&sinkLink, report->seq);
+		timesync_update(&sinkClock, report->clock);
+		lastSinkFrame = clock_time();
+		LOG_DBG("Link to the sink: rssi %d loss %u, from the sink: rssi %d loss %u\n", report->rssi, report->loss, link_quality_rssi(&sinkLink), sinkLink.loss);
+		link_quality_adapt_tx_power(report->rssi, report->loss);
+	}
+	//Configuration broadcast by the sink
+	else if(linkaddr_cmp(&linkaddr_null, dest) && (status == STATUS_REGISTERED) && linkaddr_cmp(&sinkAddress, src) && (len == sizeof(struct mess_config))){
+		struct mess_config *config = (struct mess_config*)data;
+		timesync_update(&sinkClock, config->clock);
+		lastSinkFrame = clock_time();
+		applyConfig(config);
 	}
 }
 
 PROCESS_THREAD(main_process, ev, data){
-	static uint8_t outputBuffer[20];
-	
-	struct mess_registration beaconMessage;
-	beaconMessage.secret = secret;
-	beaconMessage.t = s_node;
-	
-	static int beaconActualRetry;
+	static struct mess_sensor_node report;
 	
 	PROCESS_BEGIN();
 	cc26xx_uart_set_input(serial_line_input_byte);
@@ -154,50 +335,78 @@ PROCESS_THREAD(main_process, ev, data){
 	serialStatus = SERIAL_STATUS_IDLE;
 	serialDevice = -1;
 
+	scheduler_init(&scheduler, tasks, NUM_TASKS, &main_process);
+	for(int i = 0; i < NUM_TASKS; i++){
+		tasks[i].event = process_alloc_event();
+		tasks[i].process = (i == TASK_BLINK) ? &ui_process : &main_process;
+	}
+
+	frame_auth_init();
 	nullnet_set_input_callback(inputCallback);
 	
+	//After a reset, try to rejoin the last known sink without waiting for the button
+	sinkCached = sink_cache_load(&sinkCache);
+	if(sinkCached){
+		LOG_DBG("Rejoining the cached sink\n");
+		startConnection();
+	}
+	
 	while(1){
 		PROCESS_YIELD();
 		LOG_DBG("Status: %d\n", status);
-		if (ev == PROCESS_EVENT_TIMER){
-			//Beacon timer is expired
-			if(etimer_expired(&beaconTimer)){
-				LOG_DBG("Beacon timer\n");
-				if(status == STATUS_CONNECTING){
-					if(beaconActualRetry < beaconMaxRetry){
-						sendMessage(&beaconMessage, sizeof(beaconMessage), NULL);
-						beaconActualRetry++;
-						etimer_reset(&beaconTimer);
-					}
-					else{
-						status = STATUS_INACTIVE;
-						etimer_stop(&beaconTimer);
-						process_poll(&ui_process);
+		//The only timer of the node: post the events of the tasks that are due
+		if (scheduler_expired(&scheduler, ev, data)){
+			scheduler_run(&scheduler);
+		}
+		//Beacon task
+		else if (ev == tasks[TASK_BEACON].event){
+			LOG_DBG("Beacon timer\n");
+			if(status == STATUS_CONNECTING){
+				//The cached sink does not answer, fall back to the broadcast discovery
+				if(rejoining && beaconActualRetry >= REJOIN_MAX_RETRY){
+					LOG_DBG("Rejoin failed, sending broadcast beacons\n");
+					rejoining = false;
+					beaconActualRetry = 0;
+				}
+				if(beaconActualRetry < beaconMaxRetry){
+					//Back to the normal period after waiting for the space in the registry of the sink
+					if(tasks[TASK_BEACON].period != CLOCK_SECOND * BEACON_PERIOD){
+						scheduler_set_period(&scheduler, TASK_BEACON, CLOCK_SECOND * BEACON_PERIOD);
 					}
+					sendBeacon();
+					beaconActualRetry++;
+				}
+				else{
+					status = STATUS_INACTIVE;
+					stopConnection();
+					process_poll(&ui_process);
 				}
 			}
 		}
-		else if (ev == PROCESS_EVENT_POLL){
-			//Reporting timer is expired
-			if(ctimer_expired(&reportingTimer)){
-				if(status == STATUS_REGISTERED){//reportingTimerStatus
-					LOG_DBG("Reporting timer\n");
-					buildMessage(&valuesArray, &outputBuffer);
-					// DEBUG
-					LOG_DBG("Temperature: %d\n", (int)((struct mean)valuesArray[0]).value);
-					LOG_DBG("Humidity: %d\n", (unsigned int)((struct mean)valuesArray[1]).value);
-					LOG_DBG("Luminance: %d\n", (int)((struct mean)valuesArray[2]).value);
-					LOG_DBG("Voltage: %d\n", (int)((struct mean)valuesArray[3]).value);
-					sendMessage(&outputBuffer, (sizeof(struct mess_sensor_node)), &sinkAddress);
+		//Reporting task
+		else if (ev == tasks[TASK_REPORT].event){
+			if(status == STATUS_REGISTERED){//reportingTimerStatus
+				LOG_DBG("Reporting timer\n");
+				buildMessage(&valuesArray, &report);
+				frame_auth_tick();
+				// DEBUG
+#define LOG_CHANNEL(field, label, ...) LOG_DBG("%s: %d\n", label, valuesArray[sensor_##field].value);
+				SENSOR_CHANNELS(LOG_CHANNEL)
+#undef LOG_CHANNEL
+				if(sinkLost()){
+					LOG_DBG("Sink lost, broadcasting the readings\n");
+					sendMessage(&report, sizeof(report), NULL);
+				}
+				else{
+					sendMessage(&report, sizeof(report), &sinkAddress);
 				}
-				ctimer_restart(&reportingTimer);
-			}
-			//Collecting timer is expired
-			if(ctimer_expired(&collectingTimer)){
-				LOG_DBG("Collecting timer\n");
-				ctimer_reset(&collectingTimer);
 			}
 		}
+		//Collecting task
+		else if (ev == tasks[TASK_SAMPLE].event){
+			LOG_DBG("Collecting timer\n");
+			getSamples(&valuesArray);
+		}
 		//Inputs from serial line. Used to set collecting and reporting time at runtime
 		else if (ev == serial_line_event_message){
 			if(serialStatus == SERIAL_STATUS_IDLE){
@@ -267,9 +476,9 @@ PROCESS_THREAD(main_process, ev, data){
 						printf("New sampling period: %d\n", samplingPeriod);
 					}
 				}
-				if(status == STATUS_REGISTERED){
-					deactivateSensors();
-					activateSensors();
+				//Only the period of the task changes, the other tasks keep their deadlines
+				if(tmp > 0){
+					scheduler_set_period(&scheduler, serialDevice == 0 ? TASK_REPORT : TASK_SAMPLE, CLOCK_SECOND * tmp);
 				}
 			}
 			
@@ -293,20 +502,16 @@ PROCESS_THREAD(main_process, ev, data){
 			if(btn->unique_id == BOARD_BUTTON_HAL_INDEX_KEY_LEFT){
 				//If disconnected, tries to connect to the sink
 				if(status == STATUS_INACTIVE){ //Start sending beacons
-					status = STATUS_CONNECTING;
-					process_poll(&ui_process);
-					beaconActualRetry = 0;
-					sendMessage(&beaconMessage, sizeof(beaconMessage), NULL);
-					etimer_set(&beaconTimer, CLOCK_SECOND * BEACON_PERIOD);
+					startConnection();
 				}
 				//If connected, updates its sensors values with random
 				if(status == STATUS_REGISTERED){ //Alerates sensor's values (FOR TESTING PURPOSES)
-					if(valueIndex == 3)
+					if(valueIndex == sensor_mVolt)
 						valuesArray[valueIndex].value -= 10;
 					else
 						valuesArray[valueIndex].value += 10;
 					valueIndex++;
-					if(valueIndex > 3)
+					if(valueIndex == NUM_SENSOR_CHANNELS)
 						valueIndex = 0;
 				}
 			}
@@ -314,6 +519,7 @@ PROCESS_THREAD(main_process, ev, data){
 			if(btn->unique_id == BOARD_BUTTON_HAL_INDEX_KEY_RIGHT){
 				status = STATUS_INACTIVE;
 				process_poll(&ui_process);
+				stopConnection();
 				deactivateSensors();
 			}
 		}
@@ -326,7 +532,6 @@ PROCESS_THREAD(main_process, ev, data){
 //Node is active 			-> both OFF
 PROCESS_THREAD(ui_process, ev, data){ //Handles leds
 	PROCESS_BEGIN();
-	etimer_set(&ledTimer, CLOCK_SECOND * BLINKING_PERIOD);
 	leds_on(LEDS_RED);
 	leds_off(LEDS_GREEN);
 	while(1){
@@ -339,19 +544,16 @@ PROCESS_THREAD(ui_process, ev, data){ //Handles leds
 			else if(status == STATUS_CONNECTING){
 				leds_off(LEDS_RED);
 				leds_on(LEDS_GREEN);
-				etimer_reset(&ledTimer);
 			}
 			else{
 				leds_off(LEDS_RED);
 				leds_off(LEDS_GREEN);
 			}
 		}
-		if (ev == PROCESS_EVENT_TIMER){
-			if(etimer_expired(&ledTimer)){
-				if(status == STATUS_CONNECTING){
-					leds_toggle(LEDS_GREEN);
-					etimer_reset(&ledTimer);
-				}
+		//Blinking task, run by the scheduler of main_process
+		if (ev == tasks[TASK_BLINK].event){
+			if(status == STATUS_CONNECTING){
+				leds_toggle(LEDS_GREEN);
 			}
 		}
 	}
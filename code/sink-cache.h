@@ -0,0 +1,33 @@
+#ifndef SINK_CACHE_H_
+#define SINK_CACHE_H_
+
+/*
+	Persistence of the last known sink (address and registry slot).
+	Used by sensors and actuators to try a unicast rejoin before the broadcast discovery.
+*/
+
+#include <string.h>
+#include "persist.h"
+#include "structures.h"
+
+#define SINK_CACHE_FILE "sink_cache"
+#define SINK_CACHE_MAGIC 0x534e4b31	// "SNK1": layout of struct sink_cache
+
+// Loads the last known sink from flash. Returns false if there is nothing saved, or a cache of an older firmware
+static bool sink_cache_load(struct sink_cache *cache) {
+	if(persist_load(SINK_CACHE_FILE, SINK_CACHE_MAGIC, cache, sizeof(struct sink_cache)))
+		return true;
+	memset(cache, 0, sizeof(struct sink_cache));
+	return false;
+}
+
+// Saves the sink in flash. The flash is written only if something has changed
+static void sink_cache_save(struct sink_cache *cache, const linkaddr_t *addr, unsigned int slot) {
+	if(linkaddr_cmp(&cache->addr, addr) && cache->slot == slot)
+		return;
+	cache->addr = *addr;
+	cache->slot = slot;
+	persist_save(SINK_CACHE_FILE, SINK_CACHE_MAGIC, cache, sizeof(struct sink_cache));
+}
+
+#endif /* SINK_CACHE_H_ */
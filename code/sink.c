@@ -13,7 +13,13 @@
 
 // contiene tutte le funzioni e le var per manipolare l'indirizzo del link-layer
 #include "os/net/linkaddr.h"
+#include "cfs/cfs.h"
+#include <stddef.h>
 #include "structures.h"
+#include "rate-limiter.h"
+#include "frame-auth.h"
+#include "persist.h"
+#include "lib/trickle-timer.h"
 
 
 // Log for our Application, I can't downgrade this log at runtime
@@ -26,8 +32,9 @@
 #endif
 */
 
-#define MAX_SENSOR_NODES 1
-// ange dei vari valori dei sensori
+// The sizes of the registry (MAX_SENSOR_NODES, NUM_ZONES, MAX_ZONE_ENTRIES, ADMISSION_ENTRIES) are in project-conf.h
+
+// ange dei vari valori dei sensori (default hysteresis)
 #define TEMP_RANGE 1
 #define HUMIDITY_RANGE 1
 #define LIGHT_RANGE 1
@@ -45,13 +52,85 @@
 #define broken_light_sensor_up 20
 #define broken_light_sensor_down -20
 
-// tresholds
+// tresholds (default values, the actual ones can be changed by the serial line)
 #define temperature_treshold 10
 #define humidity_treshold 10
 #define light_treshold 10
 #define battery_treshold 800
 
-static unsigned int secret = 123456789;
+// limits to the changes of each command sent to the actuator (default values)
+#define MIN_DWELL 30	// (seconds) minimum time between two changes of the same command
+#define COMMAND_BURST 3	// changes that can be done in a row
+#define COMMAND_REFILL 120	// (seconds) time to get back one change, 0 disables the limit
+
+// trend of the readings, used to send the commands before the tresholds are crossed
+#define PREDICTION_HORIZON 60	// (seconds) default: a command is sent when the value is projected out of the band within this time, 0 disables the prediction
+#define TREND_WEIGHT 4	// EWMA weight of a new first difference is 1/TREND_WEIGHT
+#define TREND_SCALE 100	// the slope is in 1/TREND_SCALE units per minute
+#define TREND_MAX_GAP 120	// (seconds) readings of a node further apart are not used for the trend
+
+// configuration of the sensor nodes (default values) and its dissemination
+#define SAMPLING_PERIOD 2	// (seconds)
+#define REPORTING_PERIOD 9	// (seconds)
+#define CONFIG_IMIN (CLOCK_SECOND)	// Trickle: minimum interval
+#define CONFIG_IMAX 8	// Trickle: doublings of the interval (maximum about 4 minutes)
+#define CONFIG_K 1	// Trickle: up to date readings that suppress a broadcast
+
+// admission control of the frames that make the sink reply (registrations and rejoins)
+#define ADMISSION_DEDUP BEACON_PERIOD	// (seconds) minimum time between two replies to the same source: longer would drop every other beacon
+#define ADMISSION_BURST 3	// replies that can be sent in a row to the same source
+#define ADMISSION_REFILL 10	// (seconds) time to get back one reply for a source
+#define BROADCAST_BURST 5	// replies that can be sent in a row, whatever the source
+#define BROADCAST_REFILL 1	// (seconds) time to get back one of them, so that a storm of registrations can't take the radio from the data
+
+// serial console
+#define CONSOLE_PAGE_SIZE 4	// rows of a table printed before giving back the control to the other processes
+#define FAULT_WINDOWS 0x01
+#define FAULT_IRRIGATION 0x02
+#define FAULT_LIGHTS 0x04
+
+#define CONFIG_FILE "thresholds"
+#define CONFIG_MAGIC 0x43464732	// "CFG2": layout of struct sink_config, to change with it
+
+// The CONTROL_RULES (structures.h) are expanded at compile time, one check for each rule
+#define RULE_NAME(field, command, above, treshold, hysteresis, down, up) #field,
+#define RULE_COMMAND(field, command, above, treshold, hysteresis, down, up) offsetof(struct mess_to_actuator, command),
+
+static const char *const channel_names[NUM_CHANNELS] = { CONTROL_RULES(RULE_NAME) };
+
+// offset in mess_to_actuator of the command driven by each channel
+static const size_t channel_commands[NUM_CHANNELS] = { CONTROL_RULES(RULE_COMMAND) };
+
+// errors of log_mess_sensors: 1 + channel -> broken sensor
+#define ERROR_BATTERY (NUM_CHANNELS + 1)
+
+// Zone of a sensor node, kept also when the node leaves the registry
+struct zone_entry {
+	linkaddr_t addr;
+	unsigned char zone;
+};
+
+// Configuration that can be changed by the serial line, saved in flash
+struct sink_config {
+	struct threshold thresholds[NUM_ZONES][NUM_CHANNELS];
+	int battery;
+	unsigned int dwell;
+	unsigned int burst;
+	unsigned int refill;
+	unsigned int horizon;
+	unsigned short version;	// version of the configuration of the sensor nodes
+	unsigned char sampling;
+	unsigned char reporting;
+	struct zone_entry zones[MAX_ZONE_ENTRIES];
+	unsigned int zones_used;
+};
+
+// Trend of a channel in a zone: EWMA of the first differences between consecutive readings of each node of the zone
+struct trend {
+	long slope;	// 1/TREND_SCALE units per minute
+	bool valid;
+};
+
 
 // parameters for registered nides
 static struct sensor_node sensor_nodes[MAX_SENSOR_NODES];
@@ -61,10 +140,34 @@ static bool actuator_registered;
 
 // parameters for saving the data coming from nodes
 static struct mess_to_actuator previous_mess_actuator;
+static struct mess_to_actuator desired_mess_actuator;	// last commands requested by the tresholds, sent when the limits allow it
+static struct rate_limiter limiters[NUM_CHANNELS];
+static struct ctimer timer_limiter;
+static struct ctimer timer_report;
+static unsigned int report_next;	// next node that gets its link report: the sensor nodes, then the actuator
 static struct mess_sensor_node data_rcv;
 static struct mess_registration mess_reg;
 static struct actuator_status mess_act;
 
+static struct sink_config config;
+static struct trend trends[NUM_ZONES][NUM_CHANNELS];
+static struct trickle_timer trickle;	// dissemination of the configuration of the sensor nodes
+
+// Source that has asked for a reply of the sink
+struct admission_entry {
+	linkaddr_t addr;
+	unsigned long seen;	// last request received
+	struct rate_limiter limiter;	// dedup window (dwell) and token bucket of its replies
+};
+
+static struct admission_entry admission[ADMISSION_ENTRIES];
+static unsigned int admission_used = 0;
+static struct rate_limiter reply_limiter;	// replies of all the sources
+
+// state of the serial console: a table is printed a page at a time
+static bool console_dumping = false;
+static unsigned int console_next;	// next row of the sensor table to print
+
 PROCESS(sink_process, "sink_process"); 
 AUTOSTART_PROCESSES(&sink_process); 
 
@@ -77,37 +180,105 @@ static int find_sensor_node(const linkaddr_t *node) {
 	return -1;
 }
 
+// Loads the default configuration
+static void default_config() {
+	for(int z = 0; z < NUM_ZONES; z++) {
+#define RULE_DEFAULT(field, command, above, treshold, hysteresis, down, up) \
+		config.thresholds[z][ch_##field] = (struct threshold){treshold, hysteresis, down, up};
+		CONTROL_RULES(RULE_DEFAULT)
+#undef RULE_DEFAULT
+	}
+	config.battery = battery_treshold;
+	config.dwell = MIN_DWELL;
+	config.burst = COMMAND_BURST;
+	config.refill = COMMAND_REFILL;
+	config.horizon = PREDICTION_HORIZON;
+	config.version = 1;
+	config.sampling = SAMPLING_PERIOD;
+	config.reporting = REPORTING_PERIOD;
+	config.zones_used = 0;
+}
+
+// Loads the configuration from the flash, the default one if it has never been saved (or has another layout)
+static void load_config() {
+	if(persist_load(CONFIG_FILE, CONFIG_MAGIC, &config, sizeof(struct sink_config))) {
+		LOG_DBG("Configuration loaded from flash\n");
+		return;
+	}
+	default_config();
+}
+
+// Saves the configuration in flash
+static void save_config() {
+	if(persist_save(CONFIG_FILE, CONFIG_MAGIC, &config, sizeof(struct sink_config)) == false)
+		LOG_WARN("Impossible to save the configuration\n");
+}
+
+// Returns the zone of a sensor node (0 if it has not been assigned)
+static unsigned char zone_of(const linkaddr_t *node) {
+	for(int i = 0; i < config.zones_used; i++) {
+		if(linkaddr_cmp(&config.zones[i].addr, node) != 0)
+			return config.zones[i].zone;
+	}
+	return 0;
+}
+
+// Assigns a zone to a sensor node. Returns false if there is no space left
+static bool set_zone(const linkaddr_t *node, unsigned char zone) {
+	int i;
+	for(i = 0; i < config.zones_used; i++) {
+		if(linkaddr_cmp(&config.zones[i].addr, node) != 0)
+			break;
+	}
+	if(i == MAX_ZONE_ENTRIES)
+		return false;
+	if(i == config.zones_used) {
+		config.zones[i].addr = *node;
+		config.zones_used++;
+	}
+	config.zones[i].zone = zone;
+	return true;
+}
+
 // Update the actuator's timer
 static void update_timer_actuator() {
 	actuator.time = clock_seconds();
 }
 
-// Update a specific sensor node's timer
-static void update_timer_sn(const linkaddr_t *node) {
+// Update a specific sensor node's timer. Returns the sensor node's index, -1 if it doesn't exist
+static int update_timer_sn(const linkaddr_t *node) {
 	int i = find_sensor_node(node);
 	if( i != -1)
 		sensor_nodes[i].time = clock_seconds();	
+	return i;
 }
 
 // Show the messages coming from the actuator
+// and keeps track of the broken actuators
 static void log_mess_actuator() {
 	switch(mess_act.status) {
 		case windows_broken :
+			actuator.faults |= FAULT_WINDOWS;
 			LOG_WARN("TIMESTAMP: %lu. Broken windows. A technician is required\n",clock_seconds());
 			break;
 		case lights_broken:
+			actuator.faults |= FAULT_LIGHTS;
 			LOG_WARN("TIMESTAMP: %lu. Broken lights. A technician is required\n",clock_seconds());
 			break;
 		case irrigation_broken:
+			actuator.faults |= FAULT_IRRIGATION;
 			LOG_WARN("TIMESTAMP: %lu. Broken irrigation. A technician is required\n",clock_seconds());
 			break;
 		case windows_ok:
+			actuator.faults &= ~FAULT_WINDOWS;
 			LOG_WARN("TIMESTAMP: %lu. Repaired Windows\n",clock_seconds());
 			break;
 		case lights_ok:
+			actuator.faults &= ~FAULT_LIGHTS;
 			LOG_WARN("TIMESTAMP: %lu. Repaired Lights\n",clock_seconds());
 			break;
 		case irrigation_ok:
+			actuator.faults &= ~FAULT_IRRIGATION;
 			LOG_WARN("TIMESTAMP: %lu. Repaired Irrigation\n",clock_seconds());
 			break;
 	}
@@ -120,7 +291,7 @@ static void log_mess_actuator() {
 */
 static void log_inactive_node(bool sensor_node, const linkaddr_t *node) {
 	if(sensor_node) {	// sensor_node
-		LOG_WARN("TIMESTAMP: %lu. No activity detected by the sensor node: %d%d", clock_seconds(),node->u8[6],node->u8[7]);
+		LOG_WARN("TIMESTAMP: %lu. No activity detected by the sensor node: %02x%02x", clock_seconds(),node->u8[6],node->u8[7]);
 		LOG_WARN_(" for more than %d seconds\n",INACTIVE_PERIOD_SN);
 	}
 	else {	// actuator
@@ -134,38 +305,45 @@ static void log_inactive_node(bool sensor_node, const linkaddr_t *node) {
 	Shows also if a specific sensor measure an anomalous value.
 	error: 
 		0 -> no error, 
-		1 -> temp sensor, 
-		2 -> humidity sensor, 
-		3 -> light sensor, 
-		4 -> change the battery
+		1 + channel -> the sensor of the channel (see CONTROL_RULES) may be broken,
+		ERROR_BATTERY -> change the battery
 */
 static void log_mess_sensors(const linkaddr_t *node, unsigned int error) {
 	if(error == 0) {
-		LOG_INFO("TIMESTAMP: %lu. Received data: temperature: \"%d\" humidity: \"%u\"",clock_seconds(),data_rcv.temperature,data_rcv.humidity);
-		LOG_INFO_(" light: \"%d\" and battery: \"%d\" from the sensor node \"%d%d\" \n",data_rcv.light,data_rcv.mVolt, node->u8[6],node->u8[7]);
+		LOG_INFO("TIMESTAMP: %lu. Received data:",clock_seconds());
+#define LOG_CHANNEL(field, label, ...) LOG_INFO_(" %s: \"%d\"", label, data_rcv.field);
+		SENSOR_CHANNELS(LOG_CHANNEL)
+#undef LOG_CHANNEL
+		// Time of the reading on the timeline of the sink, when the node is synchronised
+		if(data_rcv.timestamp != 0)
+			LOG_INFO_(" sampled at \"%lu\"", (unsigned long)(data_rcv.timestamp / CLOCK_SECOND));
+		LOG_INFO_(" from the sensor node \"%02x%02x\" \n", node->u8[6],node->u8[7]);
+	}
+	else if(error == ERROR_BATTERY) {
+		LOG_WARN("TIMESTAMP: %lu. Change the battery. A technician is required",clock_seconds());
+		LOG_WARN_(" for sensor node \"%02x%02x\" \n",node->u8[6],node->u8[7]);
 	}
 	else {
-		switch(error) {
-			case 1 :
-				LOG_WARN("TIMESTAMP: %lu. Temperature sensor may be broken. A technician is required",clock_seconds());
-				LOG_WARN_(" for sensor node \"%d%d\" \n",node->u8[6],node->u8[7]);
-				break;	
-			case 2:
-				LOG_WARN("TIMESTAMP: %lu. Humidity sensor may be broken. A technician is required",clock_seconds());
-				LOG_WARN_(" for sensor node \"%d%d\" \n",node->u8[6],node->u8[7]);
-				break;
-			case 3:
-				LOG_WARN("TIMESTAMP: %lu. Light sensor may be broken. A technician is required",clock_seconds());
-				LOG_WARN_(" for sensor node \"%d%d\" \n",node->u8[6],node->u8[7]);
-				break;
-			case 4:
-				LOG_WARN("TIMESTAMP: %lu. Change the battery. A technician is required",clock_seconds());
-				LOG_WARN_(" for sensor node \"%d%d\" \n",node->u8[6],node->u8[7]);
-				break;
-		}
+		LOG_WARN("TIMESTAMP: %lu. The %s sensor may be broken. A technician is required",clock_seconds(),channel_names[error - 1]);
+		LOG_WARN_(" for sensor node \"%02x%02x\" \n",node->u8[6],node->u8[7]);
 	}
 }
 
+// Shows the faults detected by a sensor node on its own sensors
+static void log_sensor_faults(const linkaddr_t *node, unsigned char faults) {
+	if(faults == 0) {
+		LOG_INFO("TIMESTAMP: %lu. No more faulty sensors on the sensor node \"%02x%02x\" \n",clock_seconds(),node->u8[6],node->u8[7]);
+		return;
+	}
+#define LOG_FAULT(field, label, ...) \
+	if(faults & SENSOR_FAULT(field)) { \
+		LOG_WARN("TIMESTAMP: %lu. The %s sensor is faulty. A technician is required",clock_seconds(),label); \
+		LOG_WARN_(" for sensor node \"%02x%02x\" \n",node->u8[6],node->u8[7]); \
+	}
+	SENSOR_CHANNELS(LOG_FAULT)
+#undef LOG_FAULT
+}
+
 // Shows the command sent to the actuator
 static void log_command() {
 	if(previous_mess_actuator.open_window)
@@ -182,130 +360,491 @@ static void log_command() {
 		LOG_INFO("TIMESTAMP: %lu. Request to the actuator sent: Turn off the lights\n", clock_seconds());
 }
 
-// Adds the sensor node to the array
-static void add_sensor_node(const linkaddr_t *node) {
-	if(sn_registered == MAX_SENSOR_NODES) {
-		LOG_DBG("Impossible register new Sensor node %d%d because too many nodes are registered\n",node->u8[6], node->u8[7]);
-		return;
-	}
-	// Checks if the node already exists
+// Adds the sensor node to the array. Returns its index, -1 if there is no space
+static int add_sensor_node(const linkaddr_t *node) {
+	// Checks if the node already exists: a registered node keeps its slot also when the registry is full
 	int i = find_sensor_node(node);
 	if(i != -1) {
-		LOG_DBG("Sensor Node %d%d already exists\n", node->u8[6], node->u8[7]);
-		return;
+		LOG_DBG("Sensor Node %02x%02x already exists\n", node->u8[6], node->u8[7]);
+		return i;
+	}
+	if(sn_registered == MAX_SENSOR_NODES) {
+		LOG_DBG("Impossible register new Sensor node %02x%02x because too many nodes are registered\n",node->u8[6], node->u8[7]);
+		return -1;
 	}
 	// Adds the sensor node to the array
 	sensor_nodes[sn_registered].addr = *node;
 	sensor_nodes[sn_registered].time = clock_seconds();
+	memset(&sensor_nodes[sn_registered].last, 0, sizeof(struct mess_sensor_node));
+	sensor_nodes[sn_registered].last_time = 0;
+	sensor_nodes[sn_registered].zone = zone_of(node);
+	link_quality_reset(&sensor_nodes[sn_registered].link);
+	sensor_nodes[sn_registered].tx_seq = 0;
+	replay_window_start(&sensor_nodes[sn_registered].replay, node);
 	sn_registered ++;
-	LOG_DBG("Sensor node %d%d successfully added. ", node->u8[6],node->u8[7]);
+	LOG_DBG("Sensor node %02x%02x successfully added. ", node->u8[6],node->u8[7]);
 	LOG_DBG_("There are been registered %d sensor nodes\n", sn_registered);
-	return;
+	return sn_registered - 1;
+}
+
+/*
+	A sensor node that knows its slot is rejoining: if the slot still belongs to it
+	the registry is only refreshed (O(1)), otherwise it is registered as a new node.
+	Returns the index of the node, -1 if there is no space
+*/
+static int rejoin_sensor_node(const linkaddr_t *node, unsigned int slot) {
+	if(slot < sn_registered && linkaddr_cmp(&sensor_nodes[slot].addr, node) != 0) {
+		sensor_nodes[slot].time = clock_seconds();
+		LOG_DBG("Sensor node %02x%02x rejoined\n", node->u8[6], node->u8[7]);
+		return slot;
+	}
+	return add_sensor_node(node);
 }
 
 // Sends the action to be perform to the actuator
 static void send_to_actuator() {
-	nullnet_buf = (uint8_t*)&previous_mess_actuator;
-	nullnet_len = sizeof(struct mess_to_actuator);
-	NETSTACK_NETWORK.output(&actuator.addr);
+	previous_mess_actuator.seq = actuator.tx_seq++;
+	previous_mess_actuator.clock = clock_time();
+	frame_auth_send(&previous_mess_actuator, sizeof(struct mess_to_actuator), &actuator.addr);
 }
 
-// Sends the reply message to the registration
-static void send_registration_resp(const linkaddr_t *src) {
-	nullnet_buf = (uint8_t*)&secret;
-	nullnet_len = sizeof(unsigned int);
-	NETSTACK_NETWORK.output(src);
+/*
+	Checks if a node that asks for a registration can get a reply now and, if so, takes it from its limits.
+	A node replied less than ADMISSION_DEDUP seconds ago, or out of tokens, is ignored without transmitting
+*/
+static bool admit(const linkaddr_t *node) {
+	unsigned long now = clock_seconds();
+	struct admission_entry *e = NULL;
+	for(int i = 0; i < admission_used && e == NULL; i++) {
+		if(linkaddr_cmp(&admission[i].addr, node) != 0)
+			e = &admission[i];
+	}
+	if(e == NULL) {
+		if(admission_used < ADMISSION_ENTRIES) {
+			e = &admission[admission_used++];
+		} else {
+			e = &admission[0];
+			for(int i = 1; i < ADMISSION_ENTRIES; i++) {
+				if(admission[i].seen < e->seen)
+					e = &admission[i];
+			}
+		}
+		e->addr = *node;
+		rate_limiter_init(&e->limiter, ADMISSION_BURST, now);
+	}
+	e->seen = now;
+	if(rate_limiter_wait(&e->limiter, now, ADMISSION_DEDUP, ADMISSION_BURST, ADMISSION_REFILL) != 0) {
+		LOG_DBG("Reply to %02x%02x suppressed\n", node->u8[6], node->u8[7]);
+		return false;
+	}
+	if(rate_limiter_wait(&reply_limiter, now, 0, BROADCAST_BURST, BROADCAST_REFILL) != 0) {
+		LOG_DBG("Too many registrations, reply to %02x%02x dropped\n", node->u8[6], node->u8[7]);
+		return false;
+	}
+	rate_limiter_take(&e->limiter, now);
+	rate_limiter_take(&reply_limiter, now);
+	return true;
 }
 
-// Checks if it is necessary to send an action to the actuator
-static void verify_tresholds(const linkaddr_t* node) {
-	struct mess_to_actuator mess;
-	memcpy(&mess,&previous_mess_actuator,sizeof(struct mess_to_actuator));
-	// Checks the temperature
-	if(data_rcv.temperature > broken_temp_sensor_up || data_rcv.temperature < broken_temp_sensor_down) {
-		// Temperature sensor may be broken -> usless sends actions to the actuator
-		log_mess_sensors(node, 1);
+// Seconds after which a node of this type may find space in the registry
+static unsigned int registry_retry_after(enum type t) {
+	unsigned long now = clock_seconds();
+	unsigned long oldest = now;
+	unsigned long expiry;
+	if(t == act) {
+		oldest = actuator.time;
+		expiry = oldest + INACTIVE_PERIOD_ACT;
 	} else {
-		if(data_rcv.temperature > (temperature_treshold + TEMP_RANGE)) {
-			mess.open_window = 1;
-		}
-		if(data_rcv.temperature < (temperature_treshold - TEMP_RANGE)) {
-			mess.open_window = 0;
+		for(int i = 0; i < sn_registered; i++) {
+			if(sensor_nodes[i].time < oldest)
+				oldest = sensor_nodes[i].time;
 		}
+		expiry = oldest + INACTIVE_PERIOD_SN;
 	}
+	// The inactive nodes are removed by check_nodes_off(), every TIMER_PERIOD
+	return (expiry > now ? expiry - now : 0) + TIMER_PERIOD;
+}
 
-	// Checks the humidity
-	if(data_rcv.humidity > broken_humidity_sensor_up || data_rcv.humidity < broken_humidity_sensor_down) {
-		// Humidity sensor may be broken -> usless sends actions to the actuator
-		log_mess_sensors(node, 2);
-	} else {
-		if(data_rcv.humidity > (humidity_treshold + TEMP_RANGE)) {
-			mess.open_irrigation = 0;
+// Tells a node that there is no space for it, and when to try again
+static void send_registry_full(const linkaddr_t *src, enum type t) {
+	struct mess_registry_full full;
+	full.retry_after = registry_retry_after(t);
+	LOG_DBG("Registry full, %02x%02x has to retry after %us\n", src->u8[6], src->u8[7], full.retry_after);
+	frame_auth_send(&full, sizeof(struct mess_registry_full), src);
+}
+
+// Sends the reply message to the registration (or to the rejoin) with the index of the node in the registry
+static void send_registration_resp(const linkaddr_t *src, int slot) {
+	static struct mess_registration_resp resp;
+	if(slot < 0) {
+		send_registry_full(src, s_node);
+		return;
+	}
+	resp.slot = slot;
+	resp.clock = clock_time();
+	frame_auth_send(&resp, sizeof(struct mess_registration_resp), src);
+}
+
+// Sends to the actuator the tresholds of its zone, used by its local control when the sink is lost
+static void send_policy() {
+	struct mess_policy policy;
+	if(actuator_registered == false)
+		return;
+	memcpy(policy.thresholds, config.thresholds[0], sizeof(policy.thresholds));
+	policy.seq = actuator.tx_seq++;
+	frame_auth_send(&policy, sizeof(struct mess_policy), &actuator.addr);
+}
+
+// Broadcasts the configuration of the sensor nodes, unless enough nodes have shown to be up to date in this Trickle interval
+static void send_config(void *ptr, uint8_t suppress) {
+	struct mess_config mess;
+	if(suppress == TRICKLE_TIMER_TX_SUPPRESS)
+		return;
+	mess.version = config.version;
+	mess.sampling = config.sampling;
+	mess.reporting = config.reporting;
+	mess.clock = clock_time();
+	frame_auth_send(&mess, sizeof(struct mess_config), NULL);
+	LOG_DBG("Configuration %u broadcast\n", config.version);
+}
+
+// Sends to a node the quality of its link, seen by the sink
+static void send_link_report(const linkaddr_t *node, const struct link_quality *link, unsigned char *tx_seq) {
+	struct mess_link_report report;
+	if(link->valid == false)
+		return;
+	report.rssi = link_quality_rssi(link);
+	report.loss = link->loss;
+	report.seq = (*tx_seq)++;
+	report.clock = clock_time();
+	frame_auth_send(&report, sizeof(struct mess_link_report), node);
+}
+
+/*
+	Sends the link report of one node per tick, so that every node gets one each TIMER_PERIOD
+	without filling the queues of the MAC (CSMA keeps few neighbour queues and packet buffers)
+*/
+static void send_next_link_report(void *ptr) {
+	if(report_next < sn_registered)
+		send_link_report(&sensor_nodes[report_next].addr, &sensor_nodes[report_next].link, &sensor_nodes[report_next].tx_seq);
+	else if(report_next == sn_registered && actuator_registered)
+		send_link_report(&actuator.addr, &actuator.link, &actuator.tx_seq);
+	report_next = report_next < sn_registered ? report_next + 1 : 0;
+	ctimer_set(&timer_report, TIMER_PERIOD * CLOCK_SECOND / (sn_registered + 1), send_next_link_report, NULL);
+}
+
+// The actuator has been registered again: its counters start from the beginning
+// and the commands it follows are known at its first alive
+static void reset_actuator_link() {
+	link_quality_reset(&actuator.link);
+	actuator.tx_seq = 0;
+	actuator.state_known = false;
+}
+
+// Registers (or refreshes) a sensor node that is looking for the sink and answers it
+static void register_sensor_node(const linkaddr_t *node) {
+	int i = add_sensor_node(node);
+	if(i != -1) {
+		link_quality_reset(&sensor_nodes[i].link);
+		sensor_nodes[i].tx_seq = 0;
+	}
+	send_registration_resp(node, i);
+}
+
+// Handles the unicast rejoin of a node that remembers this sink
+static void handle_rejoin(const struct mess_rejoin *rejoin, const linkaddr_t *src) {
+	if(rejoin->t == s_node) {
+		int i = rejoin_sensor_node(src, rejoin->slot);
+		if(i != -1) {
+			// The node has been reset, its sequence numbers start again
+			link_quality_reset(&sensor_nodes[i].link);
+			link_quality_update(&sensor_nodes[i].link, rejoin->seq);
+			sensor_nodes[i].tx_seq = 0;
 		}
-		if(data_rcv.humidity < (humidity_treshold - TEMP_RANGE)) {
-			mess.open_irrigation = 1;
+		send_registration_resp(src, i);
+		return;
+	}
+	// The actuator can rejoin only if there is no other actuator registered
+	if(rejoin->t == act && (actuator_registered == false || linkaddr_cmp(&actuator.addr,src) != 0)) {
+		if(actuator_registered == false) {
+			LOG_DBG("Actuator rejoined\n");
+			actuator.faults = 0;
+			replay_window_start(&actuator.replay, src);
 		}
+		actuator_registered = true;
+		actuator.addr = *src;
+		actuator.time = clock_seconds();
+		reset_actuator_link();
+		link_quality_update(&actuator.link, rejoin->seq);
+		send_registration_resp(src, 0);
+		send_policy();
+	} else if(rejoin->t == act) {
+		send_registry_full(src, act);
 	}
+}
 
-	// Checks the light
-	if(data_rcv.light > broken_light_sensor_up || data_rcv.light < broken_light_sensor_down) {
-		// Light sensor may be broken -> usless sends actions to the actuator
-		log_mess_sensors(node, 3);
-	} else {
-		if(data_rcv.light > (light_treshold + LIGHT_RANGE)) {
-			mess.darken = 0;
-		}
-		if(data_rcv.light < (light_treshold - LIGHT_RANGE)) {
-			mess.darken = 1;
+/*
+	Sends to the actuator the desired commands allowed by the dwell time and by the rate limit.
+	The others are left in desired_mess_actuator and retried when the limits allow them
+*/
+static void apply_commands(void *ptr) {
+	unsigned long now = clock_seconds();
+	unsigned long retry = 0;
+	bool changed = false;
+	if(actuator_registered == false)
+		return;
+	for(int c = 0; c < NUM_CHANNELS; c++) {
+		bool desired = *(bool*)((uint8_t*)&desired_mess_actuator + channel_commands[c]);
+		bool *sent = (bool*)((uint8_t*)&previous_mess_actuator + channel_commands[c]);
+		if(desired == *sent)
+			continue;
+		unsigned long wait = rate_limiter_wait(&limiters[c], now, config.dwell, config.burst, config.refill);
+		if(wait == 0) {
+			rate_limiter_take(&limiters[c], now);
+			*sent = desired;
+			changed = true;
+		} else {
+			LOG_DBG("Change of %s delayed by %lu seconds\n", channel_names[c], wait);
+			if(retry == 0 || wait < retry)
+				retry = wait;
 		}
 	}
+	if(changed) {
+		log_command();
+		send_to_actuator();
+	}
+	if(retry > 0)
+		ctimer_set(&timer_limiter, retry * CLOCK_SECOND, apply_commands, NULL);
+	else
+		ctimer_stop(&timer_limiter);
+}
+
+/*
+	Aligns the commands of the sink with the ones the actuator says it is following.
+	After a registration the actuator may come from its local control: the sink goes on from that state.
+	Otherwise the actuator has missed a command, that is sent again
+*/
+static void sync_actuator_state(const struct mess_alive *alive) {
+	if(alive->open_window == previous_mess_actuator.open_window && alive->open_irrigation == previous_mess_actuator.open_irrigation &&
+		alive->darken == previous_mess_actuator.darken) {
+		actuator.state_known = true;
+		return;
+	}
+	previous_mess_actuator.open_window = alive->open_window;
+	previous_mess_actuator.open_irrigation = alive->open_irrigation;
+	previous_mess_actuator.darken = alive->darken;
+	if(actuator.state_known == false) {
+		LOG_INFO("TIMESTAMP: %lu. The actuator hands back the control\n", clock_seconds());
+		memcpy(&desired_mess_actuator,&previous_mess_actuator,sizeof(struct mess_to_actuator));
+		actuator.state_known = true;
+	} else {
+		LOG_DBG("The actuator has missed a command\n");
+	}
+	apply_commands(NULL);
+}
+
+// Adds to the trend of a channel the difference between two readings of a node, dt ticks apart. O(1)
+static void update_trend(struct trend *t, int diff, unsigned int dt) {
+	long sample = (long)((int64_t)diff * TREND_SCALE * 60 * CLOCK_SECOND / dt);
+	t->slope = t->valid ? t->slope + (sample - t->slope) / TREND_WEIGHT : sample;
+	t->valid = true;
+}
+
+// Updates the trends of the zone of a node with its new reading, taken at time (timeline of the sink)
+static void update_trends(const struct sensor_node *sn, const struct mess_sensor_node *reading, unsigned int time) {
+	unsigned int dt = time - sn->last_time;
+	if(sn->last_time == 0 || dt == 0 || dt > TREND_MAX_GAP * CLOCK_SECOND)
+		return;
+	// The channels that are (or were) faulty would give wrong slopes
+#define RULE_TREND(field, ...) \
+	if(((reading->faults | sn->last.faults) & SENSOR_FAULT(field)) == 0) \
+		update_trend(&trends[sn->zone][ch_##field], reading->field - sn->last.field, dt);
+	CONTROL_RULES(RULE_TREND)
+#undef RULE_TREND
+}
+
+// Value of a channel projected over the horizon by its trend
+static int project(const struct trend *t, int value) {
+	if(t->valid == false || config.horizon == 0)
+		return value;
+	return value + (int)((int64_t)t->slope * config.horizon / (60 * TREND_SCALE));
+}
+
+/*
+	Checks a channel against its treshold and updates the command it drives.
+	While the value is inside the band the projected one is used, so that the command is sent
+	before the treshold is crossed when the trend will take the value out of the band within the horizon
+*/
+static inline void check_channel(const linkaddr_t* node, int value, int projected, const struct threshold *th, bool *command, bool above, unsigned int channel) {
+	if(value > th->broken_up || value < th->broken_down) {
+		// Sensor may be broken -> usless sends actions to the actuator
+		log_mess_sensors(node, 1 + channel);
+		return;
+	}
+	if(value >= th->treshold - th->hysteresis && value <= th->treshold + th->hysteresis && projected != value) {
+		LOG_DBG("The %s is %d, projected %d in %us\n", channel_names[channel], value, projected, config.horizon);
+		value = projected;
+	}
+	*command = (value > th->treshold + th->hysteresis) ? above : (value < th->treshold - th->hysteresis) ? !above : *command;
+}
+
+// Checks if it is necessary to send an action to the actuator, using the tresholds of the zone of the node
+static void verify_tresholds(const linkaddr_t* node, unsigned char zone) {
+	struct mess_to_actuator mess;
+	memcpy(&mess,&previous_mess_actuator,sizeof(struct mess_to_actuator));
+	// One check for each rule, with the fields known at compile time
+	// The channels flagged as faulty by the node are skipped
+#define RULE_CHECK(field, command, above, treshold, hysteresis, down, up) \
+	if((data_rcv.faults & SENSOR_FAULT(field)) == 0) \
+		check_channel(node, data_rcv.field, project(&trends[zone][ch_##field], data_rcv.field), &config.thresholds[zone][ch_##field], &mess.command, above, ch_##field);
+	CONTROL_RULES(RULE_CHECK)
+#undef RULE_CHECK
 
 	// Checks the level of the battery
-	if(data_rcv.mVolt < battery_treshold) {
-		log_mess_sensors(node, 4);
+	if((data_rcv.faults & SENSOR_FAULT(mVolt)) == 0 && data_rcv.mVolt < config.battery) {
+		log_mess_sensors(node, ERROR_BATTERY);
 	}
 
-	// Checks if anything has changed with respect to the last message sent to the actuator
-	if(mess.open_window != previous_mess_actuator.open_window || mess.open_irrigation != previous_mess_actuator.open_irrigation || mess.darken != previous_mess_actuator.darken) { 
-		memcpy(&previous_mess_actuator,&mess,sizeof(struct mess_to_actuator));
-		log_command();
-		send_to_actuator();
+	// The latest request replaces the one that is still waiting for the limits
+	memcpy(&desired_mess_actuator,&mess,sizeof(struct mess_to_actuator));
+	apply_commands(NULL);
+}
+
+// Handles the readings (or the faults) sent by a sensor node
+static void handle_sensor_data(const void *data, uint16_t len, const linkaddr_t *src) {
+	int i = update_timer_sn(src);
+	// The faulty sensors of the node have changed
+	if(len == sizeof(struct mess_sensor_fault)) {
+		const struct mess_sensor_fault *fault = (const struct mess_sensor_fault*)data;
+		if(i != -1) {
+			sensor_nodes[i].last.faults = fault->faults;
+			link_quality_update(&sensor_nodes[i].link, fault->seq);
+		}
+		log_sensor_faults(src, fault->faults);
+		return;
+	}
+	if(len != sizeof(*(struct mess_sensor_node*)data)) {
+		LOG_DBG("The message received is not intact, error\n");
+		return;
 	}
+	/*
+		A node with an old configuration makes the Trickle interval start again. A node with a newer one
+		(e.g. the configuration of the sink has been lost) would never accept ours: it gets a version above its own
+	*/
+	short age = ((const struct mess_sensor_node*)data)->config_version - config.version;
+	if(age > 0) {
+		config.version = ((const struct mess_sensor_node*)data)->config_version + 1;
+		save_config();
+		LOG_DBG("Configuration older than the one of %02x%02x, now version %u\n", src->u8[6], src->u8[7], config.version);
+		trickle_timer_reset_event(&trickle);
+	} else if(age < 0) {
+		trickle_timer_inconsistency(&trickle);
+	} else {
+		trickle_timer_consistency(&trickle);
+	}
+	// Keeps the last reading for the serial console and the trends
+	if(i != -1) {
+		const struct mess_sensor_node *reading = (const struct mess_sensor_node*)data;
+		// Time of the sample if the node is synchronised, otherwise time of arrival
+		unsigned int time = reading->timestamp != 0 ? reading->timestamp : clock_time();
+		update_trends(&sensor_nodes[i], reading, time);
+		memcpy(&sensor_nodes[i].last,data,sizeof(struct mess_sensor_node));
+		sensor_nodes[i].last_time = time;
+		link_quality_update(&sensor_nodes[i].link, sensor_nodes[i].last.seq);
+	}
+	// Every reading reaches the console (and the ingest tool), also without the actuator
+	memcpy(&data_rcv,(struct mess_sensor_node*)data,sizeof(struct mess_sensor_node));
+	log_mess_sensors(src,0);
+	if(actuator_registered == false) {
+		LOG_DBG("The actuator has not yet registered, no need to check the tresholds, %i\n",actuator_registered);
+		return;
+	}
+	verify_tresholds(src, i != -1 ? sensor_nodes[i].zone : zone_of(src));
+}
+
+// Replay window of a registered sender, NULL if the sender is not registered
+static struct replay_window *replay_window_of(const linkaddr_t *src) {
+	if(actuator_registered && linkaddr_cmp(&actuator.addr,src) != 0)
+		return &actuator.replay;
+	int i = find_sensor_node(src);
+	return i != -1 ? &sensor_nodes[i].replay : NULL;
+}
+
+// Frames the sink handles: the broadcast readings and registrations, the rejoins and the messages of the registered nodes
+static bool sink_handles(uint16_t len, const linkaddr_t *src, const linkaddr_t *dest) {
+	if(linkaddr_cmp(&linkaddr_null,dest) != 0)
+		return len == sizeof(struct mess_sensor_node) || len == sizeof(struct mess_registration);
+	if(len == sizeof(struct mess_rejoin) || replay_window_of(src) != NULL)
+		return true;
+	LOG_DBG("Incoming message from non registered node\n");
+	return false;
 }
 
 // Is called whenever a message arrives 
 static void input_callback(const void *data, uint16_t len, const linkaddr_t *src, const linkaddr_t *dest){	
-	if(*(unsigned int*)data != secret) {
-		LOG_DBG("Message comes from an intruder\n");
+	// Forged, corrupted or replayed frames are dropped before anything else, without logging
+	len = frame_auth_open(data, len, src);
+	if(len == 0)
+		return;
+	if(sink_handles(len, src, dest) == false)
+		return;
+	// The senders out of the registry are checked against the highest counter ever received from them
+	if(frame_auth_fresh(replay_window_of(src), src, frame_auth_counter_of(data)) == false)
 		return;
-	}
 
 	if(linkaddr_cmp(&linkaddr_null,dest) != 0) {	// messaggio broadcast
+		// A sensor node that has lost the sink broadcasts its readings
+		if(len == sizeof(struct mess_sensor_node)) {
+			// The sink has been reset (or has dropped the node): the node is registered again
+			if(find_sensor_node(src) == -1 && admit(src))
+				register_sensor_node(src);
+			// Not admitted or no space in the registry: its readings can't drive the actuator
+			if(find_sensor_node(src) == -1)
+				return;
+			handle_sensor_data(data, len, src);
+			return;
+		}
 		if(len != sizeof(*(struct mess_registration*)data)) {
 			LOG_DBG("The message received is not intact, error\n");
 			return;
 		}
 		memcpy(&mess_reg,data,sizeof(struct mess_registration));
+		// Duplicated or too frequent registrations are dropped here, before any work
+		if(admit(src) == false)
+			return;
 
 		// The message comes from a sensor node
 		if(mess_reg.t == s_node) {	
 			linkaddr_t tmp = *src;
-			add_sensor_node(&tmp);
-			send_registration_resp(&tmp);
+			register_sensor_node(&tmp);
 		}
 
-		// The message comes from the actuator
-		if(actuator_registered == false && mess_reg.t == act) {
+		// The message comes from the actuator (the registered one that has lost the sink gets the reply again)
+		if(mess_reg.t == act) {
+			if(actuator_registered && linkaddr_cmp(&actuator.addr,src) == 0) {
+				send_registry_full(src, act);
+				return;
+			}
+			if(actuator_registered == false) {
+				actuator.faults = 0;
+				replay_window_start(&actuator.replay, src);
+			}
 			actuator_registered = true;
 			LOG_DBG("Actuators registered %d\n", actuator_registered);
 			actuator.addr = *src;
 			actuator.time = clock_seconds();
-			send_registration_resp(&actuator.addr);
+			reset_actuator_link();
+			send_registration_resp(&actuator.addr, 0);
+			send_policy();
 		}
 		return;
 	} else {	// Unicast message
-		if((actuator_registered && linkaddr_cmp(&actuator.addr,src) == 0) && (find_sensor_node(src) == -1)) {
-			LOG_DBG("Incoming message from non registered node\n");
+		// A node that has been reset or disconnected is rejoining
+		if(len == sizeof(struct mess_rejoin)) {
+			struct mess_rejoin rejoin;
+			memcpy(&rejoin,data,sizeof(struct mess_rejoin));
+			if(admit(src))
+				handle_rejoin(&rejoin, src);
 			return;
 		}
 
@@ -314,8 +853,10 @@ static void input_callback(const void *data, uint16_t len, const linkaddr_t *src
 			update_timer_actuator();
 
 			// Mess "I'm Alive"
-			if(len == sizeof(unsigned int)) {
+			if(len == sizeof(struct mess_alive)) {
 				LOG_DBG("Ack dall'actuator\n");
+				link_quality_update(&actuator.link, ((struct mess_alive*)data)->seq);
+				sync_actuator_state((const struct mess_alive*)data);
 				return;
 			}
 			// Mess with info
@@ -324,26 +865,15 @@ static void input_callback(const void *data, uint16_t len, const linkaddr_t *src
 				return;
 			} else {
 				memcpy(&mess_act,data,len);
+				link_quality_update(&actuator.link, mess_act.seq);
 				log_mess_actuator();
 			}
 			return;
 		}
 
 		// Sensor node has sent data
-		if(data != NULL && linkaddr_cmp(&actuator.addr,src) == 0) {	
-			update_timer_sn(src);
-			if(len != sizeof(*(struct mess_sensor_node*)data)) {
-				LOG_DBG("The message received is not intact, error\n");
-				return;
-			}
-			if(actuator_registered == false) {
-				LOG_DBG("The actuator has not yet registered, no need to check the tresholds, %i\n",actuator_registered);
-				return;
-			}
-			memcpy(&data_rcv,(struct mess_sensor_node*)data,sizeof(struct mess_sensor_node));
-			log_mess_sensors(src,0);
-			verify_tresholds(src);
-		}
+		if(data != NULL && linkaddr_cmp(&actuator.addr,src) == 0)
+			handle_sensor_data(data, len, src);
 	}
 }
 
@@ -352,13 +882,10 @@ void check_nodes_off(){
 	// Searchs inactive sensor nodes in the array and if there is a deletion keep the compact array
 	for(int i = sn_registered - 1; i >= 0; i--) {
 		if(sensor_nodes[i].time < (clock_seconds()-INACTIVE_PERIOD_SN)) {
+			log_inactive_node(1, &sensor_nodes[i].addr);
 			sn_registered --;
-			if(i != sn_registered -1) {	// It is not deleting the last item
-				log_inactive_node(1, &sensor_nodes[i].addr);
+			if(i != sn_registered)	// It is not deleting the last item: the last one (already checked) takes its place
 				sensor_nodes[i] = sensor_nodes[sn_registered];
-			}
-			else // it is deleting the last item
-				log_inactive_node(1, &sensor_nodes[i].addr);
 		}
 	}
 
@@ -367,28 +894,211 @@ void check_nodes_off(){
 		actuator_registered = false;
 		log_inactive_node(0, NULL);
 	}
+	frame_auth_tick();
 	process_poll(&sink_process);
 }
 
+// Prints the help of the serial console
+static void console_help() {
+	printf("Commands:\n");
+	printf("\t'sensors' registered sensor nodes\n");
+	printf("\t'actuator' actuator state and faults\n");
+	printf("\t'thresholds' threshold configuration\n");
+	printf("\t'set <zone> <channel> <treshold|hysteresis|min|max> <value>' changes a treshold\n");
+	printf("\t'battery <value>' changes the battery treshold\n");
+	printf("\t'zone <index> <zone>' moves a registered sensor node to a zone\n");
+	printf("\t'limits <dwell> <burst> <refill>' limits the changes of the commands\n");
+	printf("\t'horizon <seconds>' sends the commands earlier by the trend of the readings (0 -> disabled)\n");
+	printf("\t'periods <sampling> <reporting>' changes the periods of all the sensor nodes\n");
+}
+
+// Prints a page of the sensor table. If there are other rows, the process continues later
+static void console_sensors_page() {
+	unsigned int printed;
+	unsigned long now = clock_seconds();
+	for(printed = 0; printed < CONSOLE_PAGE_SIZE && console_next < sn_registered; printed++, console_next++) {
+		struct sensor_node *sn = &sensor_nodes[console_next];
+		printf("%u: node %02x%02x seen %lus ago,", console_next, sn->addr.u8[6], sn->addr.u8[7], now - sn->time);
+		if(sn->last.timestamp != 0)
+			printf(" sampled %lus ago,", (unsigned long)((clock_time() - sn->last.timestamp) / CLOCK_SECOND));
+#define PRINT_CHANNEL(field, label, ...) printf(" %s %d%s", label, sn->last.field, (sn->last.faults & SENSOR_FAULT(field)) ? " (faulty)" : "");
+		SENSOR_CHANNELS(PRINT_CHANNEL)
+#undef PRINT_CHANNEL
+		printf(", rssi %d loss %u%%\n", link_quality_rssi(&sn->link), sn->link.loss);
+	}
+	if(console_next < sn_registered) {
+		process_post(&sink_process, PROCESS_EVENT_CONTINUE, NULL);
+	} else {
+		printf("%u sensor nodes registered (max %d)\n", sn_registered, MAX_SENSOR_NODES);
+		console_dumping = false;
+	}
+}
+
+static void console_actuator() {
+	if(actuator_registered == false) {
+		printf("Actuator not registered\n");
+		return;
+	}
+	printf("Actuator %02x%02x seen %lus ago, rssi %d loss %u%%\n", actuator.addr.u8[6], actuator.addr.u8[7], clock_seconds() - actuator.time,
+		link_quality_rssi(&actuator.link), actuator.link.loss);
+	printf("\twindows: %s%s\n", previous_mess_actuator.open_window ? "open" : "closed", (actuator.faults & FAULT_WINDOWS) ? " BROKEN" : "");
+	printf("\tirrigation: %s%s\n", previous_mess_actuator.open_irrigation ? "on" : "off", (actuator.faults & FAULT_IRRIGATION) ? " BROKEN" : "");
+	printf("\tlights: %s%s\n", previous_mess_actuator.darken ? "on" : "off", (actuator.faults & FAULT_LIGHTS) ? " BROKEN" : "");
+}
+
+static void console_thresholds() {
+	for(int z = 0; z < NUM_ZONES; z++) {
+		printf("zone %d:\n", z);
+		for(int c = 0; c < NUM_CHANNELS; c++) {
+			const struct threshold *th = &config.thresholds[z][c];
+			printf("\t%s: treshold %d hysteresis %d, sensor broken outside [%d, %d]", channel_names[c], th->treshold, th->hysteresis, th->broken_down, th->broken_up);
+			if(trends[z][c].valid)
+				printf(", trend %ld per hour", trends[z][c].slope * 60 / TREND_SCALE);
+			printf("\n");
+		}
+	}
+	printf("battery: treshold %d\n", config.battery);
+	printf("commands: dwell %us, burst %u, one change every %us\n", config.dwell, config.burst, config.refill);
+	printf("prediction horizon: %us\n", config.horizon);
+	printf("sensor nodes: configuration %u, sampling every %us, reporting every %us\n", config.version, config.sampling, config.reporting);
+}
+
+// Changes a field of a treshold: 'set <zone> <channel> <field> <value>'
+static bool console_set(const char *cmd) {
+	int zone, value, c;
+	char channel[16], field[16];
+	struct threshold *th;
+	if(sscanf(cmd, "set %d %15s %15s %d", &zone, channel, field, &value) != 4 || zone < 0 || zone >= NUM_ZONES)
+		return false;
+	if(value < INT16_MIN || value > INT16_MAX)	// the tresholds are sent to the actuator in 16 bits
+		return false;
+	for(c = 0; c < NUM_CHANNELS && strcmp(channel, channel_names[c]) != 0; c++);
+	if(c == NUM_CHANNELS)
+		return false;
+	th = &config.thresholds[zone][c];
+	if(strcmp(field, "treshold") == 0)
+		th->treshold = value;
+	else if(strcmp(field, "hysteresis") == 0 && value >= 0)
+		th->hysteresis = value;
+	else if(strcmp(field, "min") == 0)
+		th->broken_down = value;
+	else if(strcmp(field, "max") == 0)
+		th->broken_up = value;
+	else
+		return false;
+	return true;
+}
+
+// Moves a registered sensor node to a zone: 'zone <index> <zone>'
+static bool console_zone(const char *cmd) {
+	unsigned int index, zone;
+	if(sscanf(cmd, "zone %u %u", &index, &zone) != 2 || index >= sn_registered || zone >= NUM_ZONES)
+		return false;
+	if(set_zone(&sensor_nodes[index].addr, zone) == false) {
+		printf("Too many zone assignments\n");
+		return false;
+	}
+	sensor_nodes[index].zone = zone;
+	return true;
+}
+
+// Changes the limits of the commands: 'limits <dwell> <burst> <refill>'
+static bool console_limits(const char *cmd) {
+	unsigned int dwell, burst, refill;
+	if(sscanf(cmd, "limits %u %u %u", &dwell, &burst, &refill) != 3 || burst == 0)
+		return false;
+	config.dwell = dwell;
+	config.burst = burst;
+	config.refill = refill;
+	return true;
+}
+
+// Changes the periods of the sensor nodes: 'periods <sampling> <reporting>'. The new version is spread by Trickle
+static bool console_periods(const char *cmd) {
+	unsigned int sampling, reporting;
+	if(sscanf(cmd, "periods %u %u", &sampling, &reporting) != 2 || sampling == 0 || sampling > 255 || reporting == 0 || reporting > 255)
+		return false;
+	config.sampling = sampling;
+	config.reporting = reporting;
+	config.version++;
+	trickle_timer_reset_event(&trickle);
+	return true;
+}
+
+// Executes a command received from the serial line
+static void console_command(const char *cmd) {
+	if(strcmp(cmd, "sensors") == 0) {
+		// A dump already in progress is restarted
+		console_next = 0;
+		if(console_dumping == false) {
+			console_dumping = true;
+			process_post(&sink_process, PROCESS_EVENT_CONTINUE, NULL);
+		}
+	} else if(strcmp(cmd, "actuator") == 0) {
+		console_actuator();
+	} else if(strcmp(cmd, "thresholds") == 0) {
+		console_thresholds();
+	} else if(strncmp(cmd, "set ", 4) == 0 || strncmp(cmd, "battery ", 8) == 0 || strncmp(cmd, "zone ", 5) == 0 || strncmp(cmd, "limits ", 7) == 0 || strncmp(cmd, "horizon ", 8) == 0 || strncmp(cmd, "periods ", 8) == 0) {
+		bool ok;
+		if(cmd[0] == 's')
+			ok = console_set(cmd);
+		else if(cmd[0] == 'b')
+			ok = sscanf(cmd, "battery %d", &config.battery) == 1;
+		else if(cmd[0] == 'z')
+			ok = console_zone(cmd);
+		else if(cmd[0] == 'p')
+			ok = console_periods(cmd);
+		else if(cmd[0] == 'h')
+			ok = sscanf(cmd, "horizon %u", &config.horizon) == 1;
+		else
+			ok = console_limits(cmd);
+		if(ok) {
+			save_config();
+			send_policy();
+			printf("Configuration saved\n");
+		} else {
+			printf("Invalid command\n");
+		}
+	} else {
+		console_help();
+	}
+}
+
 PROCESS_THREAD(sink_process, ev, data){
 	static struct ctimer timer_check;
 
 	PROCESS_BEGIN();
 
 	// Initialize the parameters
-	previous_mess_actuator.secret = secret;
 	previous_mess_actuator.open_window = false;
 	previous_mess_actuator.open_irrigation = false;
 	previous_mess_actuator.darken = false;
+	memcpy(&desired_mess_actuator,&previous_mess_actuator,sizeof(struct mess_to_actuator));
 	actuator_registered = false;
+	load_config();
+	for(int c = 0; c < NUM_CHANNELS; c++)
+		rate_limiter_init(&limiters[c], config.burst, clock_seconds());
+	rate_limiter_init(&reply_limiter, BROADCAST_BURST, clock_seconds());
+
+	cc26xx_uart_set_input(serial_line_input_byte);
+	serial_line_init();
 
+	frame_auth_init();
 	nullnet_set_input_callback(input_callback);
+	trickle_timer_config(&trickle, CONFIG_IMIN, CONFIG_IMAX, CONFIG_K);
+	trickle_timer_set(&trickle, send_config, NULL);
 	ctimer_set(&timer_check, TIMER_PERIOD * CLOCK_SECOND, check_nodes_off, NULL);
+	// Tells to the active nodes the quality of their link, so that they can adapt the transmission power
+	ctimer_set(&timer_report, TIMER_PERIOD * CLOCK_SECOND, send_next_link_report, NULL);
 
 	while(1) {
 		PROCESS_YIELD();
 		if(ev == PROCESS_EVENT_POLL) {
 			ctimer_restart(&timer_check);
+		} else if(ev == serial_line_event_message) {
+			console_command((const char*)data);
+		} else if(ev == PROCESS_EVENT_CONTINUE && console_dumping) {
+			console_sensors_page();
 		}
 	}	
 	PROCESS_END();
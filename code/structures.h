@@ -0,0 +1,285 @@
+#ifndef STRUCTURES_H_
+#define STRUCTURES_H_
+
+#include "contiki.h"
+#include "net/linkaddr.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "link-quality.h"
+#include "frame-auth.h"
+
+/*
+	Every frame is authenticated (frame-auth.h): the first field of each message is the frame counter of the sender
+	and the MIC is appended after the message.
+	Every frame sent to (or by) the sink carries a sequence number (seq), one counter for each link,
+	used by the receiver to estimate the lost frames.
+	The frames sent by the sink carry also its clock_time() (clock), used by the nodes to synchronise with it.
+
+	The messages are sent as they are in memory: they are packed (WIRE), with fixed size fields in little endian,
+	the byte order of every target (CC26xx and native). The receiver recognises a message by its length,
+	so the sizes are checked at compile time at the end of this file
+*/
+#define WIRE __attribute__((packed))
+
+_Static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "the messages are little endian");
+
+/*
+	Channels sampled by the sensor node:
+	X(field, label, sampling function, minimum and maximum valid sample, equal samples in a row that mean a stuck sensor (0 -> never))
+	This table generates the sampling calls of the sensor, the layout of mess_sensor_node and
+	the decode of the sink: to add a channel (e.g. soil moisture) add a line here
+	(and a rule in the CONTROL_RULES of the sink if it drives the actuator)
+*/
+#define SENSOR_CHANNELS(X) \
+	X(temperature, "temperature", getValue, -40, 85, 20) \
+	X(humidity, "humidity", getValue, 0, 100, 20) \
+	X(light, "light", getValue, 0, 1000, 20) \
+	X(mVolt, "battery", getValueBat, 1800, 3800, 0)
+
+#define SENSOR_CHANNEL_INDEX(field, ...) sensor_##field,
+#define SENSOR_CHANNEL_FIELD(field, ...) int16_t field;
+
+enum sensor_channel {
+	SENSOR_CHANNELS(SENSOR_CHANNEL_INDEX)
+	NUM_SENSOR_CHANNELS
+};
+
+// Bit of a channel in the faults of mess_sensor_node (at most 8 channels)
+#define SENSOR_FAULT(field) (1 << sensor_##field)
+
+/*
+	Channels of SENSOR_CHANNELS checked against the tresholds:
+	X(field of mess_sensor_node, command of mess_to_actuator, command to send when the value is above the treshold,
+	  default treshold, default hysteresis, default broken sensor limits)
+	Used by the sink and by the actuator when it controls on its own (the default values are defined by the sink)
+*/
+#define CONTROL_RULES(X) \
+	X(temperature, open_window, true, temperature_treshold, TEMP_RANGE, broken_temp_sensor_down, broken_temp_sensor_up) \
+	X(humidity, open_irrigation, false, humidity_treshold, HUMIDITY_RANGE, broken_humidity_sensor_down, broken_humidity_sensor_up) \
+	X(light, darken, false, light_treshold, LIGHT_RANGE, broken_light_sensor_down, broken_light_sensor_up)
+
+#define RULE_INDEX(field, ...) ch_##field,
+
+// channels checked against the tresholds
+enum channel_id {
+	CONTROL_RULES(RULE_INDEX)
+	NUM_CHANNELS
+};
+
+/*
+	Without frames from the sink for this time (seconds) the nodes consider it lost: the sensors broadcast
+	their readings and the actuator controls on its own. The sink sends a link report to each node every 15 seconds
+*/
+#define SINK_SILENCE_DEADLINE 45
+
+// Period (seconds) of the registration beacons of the sensor nodes, the sink replies at most once in it to the same node
+#define BEACON_PERIOD 1
+
+// Kind of node that is asking for the registration
+enum type {
+	s_node,	// sensor node
+	act	// actuator
+};
+
+// Info sent by the actuator to the sink when an actuator breaks or is repaired
+enum actuator_info {
+	windows_broken,
+	lights_broken,
+	irrigation_broken,
+	windows_ok,
+	lights_ok,
+	irrigation_ok
+};
+
+// Broadcast message sent by a node that is looking for the sink
+struct mess_registration {
+	uint32_t counter;
+	uint8_t t;	// enum type
+} WIRE;
+
+/*
+	Unicast message sent to the last known sink by a node that has been reset or disconnected.
+	slot is the index the sink gave to the node in its registry, so that the sink can refresh it in O(1)
+*/
+struct mess_rejoin {
+	uint32_t counter;
+	uint8_t t;	// enum type
+	uint16_t slot;
+	uint8_t seq;
+} WIRE;
+
+// Reply of the sink to a registration or to a rejoin
+struct mess_registration_resp {
+	uint32_t counter;
+	uint16_t slot;
+	uint32_t clock;
+} WIRE;
+
+// Reply of the sink when its registry has no space left: the node can try again after retry_after seconds
+struct mess_registry_full {
+	uint32_t counter;
+	uint16_t retry_after;
+} WIRE;
+
+// Data sent by the sensor node to the sink
+struct mess_sensor_node {
+	uint32_t counter;
+	SENSOR_CHANNELS(SENSOR_CHANNEL_FIELD)
+	uint32_t timestamp;	// time of the last sample, on the timeline of the sink (0 -> node not synchronised)
+	uint8_t faults;	// channels whose sensor is faulty, their values must not be used
+	uint8_t seq;
+	uint16_t config_version;	// version of the mess_config applied by the node
+} WIRE;
+
+// Sent by the sensor node only when the set of faulty channels changes
+struct mess_sensor_fault {
+	uint32_t counter;
+	uint8_t faults;
+	uint8_t seq;
+} WIRE;
+
+/*
+	Configuration of the sensor nodes, broadcast by the sink with the Trickle algorithm.
+	Every new configuration has a new version: the nodes advertise the one they have in their readings
+	and the sink broadcasts again only when a node is out of date
+*/
+struct mess_config {
+	uint32_t counter;
+	uint16_t version;
+	uint8_t sampling;	// sampling period (seconds)
+	uint8_t reporting;	// reporting period (seconds)
+	uint32_t clock;
+} WIRE;
+
+// Command sent by the sink to the actuator
+struct mess_to_actuator {
+	uint32_t counter;
+	bool open_window;
+	bool open_irrigation;
+	bool darken;
+	uint8_t seq;
+	uint32_t clock;
+} WIRE;
+
+// Message sent by the actuator to the sink when one of its actuators changes
+struct actuator_status {
+	uint32_t counter;
+	uint8_t status;	// enum actuator_info
+	uint8_t seq;
+} WIRE;
+
+/*
+	Message sent periodically by the actuator to tell the sink that it's alive.
+	Carries the commands the actuator is following (from the sink or from its local control)
+*/
+struct mess_alive {
+	uint32_t counter;
+	uint8_t seq;
+	bool open_window;
+	bool open_irrigation;
+	bool darken;
+	uint8_t reserved;	// 0: keeps the length different from mess_rejoin
+} WIRE;
+
+// Quality of the link seen by the sink, sent periodically to each node to adapt its transmission power
+struct mess_link_report {
+	uint32_t counter;
+	int8_t rssi;	// dBm
+	uint8_t loss;	// percent
+	uint8_t seq;
+	uint32_t clock;
+} WIRE;
+
+/*
+	Registered sensor node (sink side): one for each entry of the registry (MAX_SENSOR_NODES, project-conf.h),
+	the fields are ordered by alignment so that the entry has no padding
+*/
+struct sensor_node {
+	linkaddr_t addr;
+	unsigned long time;	// last time the node has been seen
+	unsigned int last_time;	// time of the last reading on the timeline of the sink (0 -> no reading yet)
+	struct replay_window replay;	// frame counters received from the node
+	struct link_quality link;	// link from the node to the sink
+	struct mess_sensor_node last;	// last reading received
+	unsigned char zone;	// zone of the orchard where the node is placed
+	unsigned char tx_seq;	// sequence number of the next frame sent to the node
+};
+
+/*
+	Control parameters of a channel (temperature, humidity, light) in a zone.
+	The actuator is commanded when the value goes out of [treshold - hysteresis, treshold + hysteresis],
+	the sensor is considered broken when the value goes out of [broken_down, broken_up]
+*/
+struct threshold {
+	int16_t treshold;
+	int16_t hysteresis;
+	int16_t broken_down;
+	int16_t broken_up;
+} WIRE;
+
+/*
+	Control policy sent by the sink to the actuator when it registers and when the tresholds change:
+	the tresholds of the zone of the actuator (zone 0), used by the actuator while the sink is lost
+*/
+struct mess_policy {
+	uint32_t counter;
+	struct threshold thresholds[NUM_CHANNELS];
+	uint8_t seq;
+} WIRE;
+
+// Registered actuator (sink side)
+struct actuator_node {
+	linkaddr_t addr;
+	unsigned long time;	// last time the node has been seen
+	unsigned char faults;	// broken actuators
+	struct link_quality link;	// link from the actuator to the sink
+	unsigned char tx_seq;	// sequence number of the next frame sent to the actuator
+	struct replay_window replay;	// frame counters received from the actuator
+	bool state_known;	// the sink knows the commands the actuator is following (false until its first alive)
+};
+
+// Last known sink, saved in flash by sensors and actuators to rejoin it after a reset
+struct sink_cache {
+	linkaddr_t addr;
+	unsigned int slot;
+};
+
+/*
+	Size of each message on the air (without the MIC). The receivers tell the messages apart by their length:
+	the messages that can reach the same receiver in the same state must have different sizes
+*/
+#define WIRE_SIZE(type, size) _Static_assert(sizeof(struct type) == (size), "size of " #type " on the air"); \
+	_Static_assert((size) <= FRAME_AUTH_MAX_PAYLOAD, #type " doesn't fit in the frame buffer");
+#define WIRE_DISTINCT(a, b) _Static_assert(sizeof(struct a) != sizeof(struct b), #a " and " #b " have the same length");
+
+WIRE_SIZE(mess_registration, 5)
+WIRE_SIZE(mess_rejoin, 8)
+WIRE_SIZE(mess_registration_resp, 10)
+WIRE_SIZE(mess_registry_full, 6)
+WIRE_SIZE(mess_sensor_node, 8 + 2 * NUM_SENSOR_CHANNELS + 4)
+WIRE_SIZE(mess_sensor_fault, 6)
+WIRE_SIZE(mess_config, 12)
+WIRE_SIZE(mess_to_actuator, 12)
+WIRE_SIZE(actuator_status, 6)
+WIRE_SIZE(mess_alive, 9)
+WIRE_SIZE(mess_link_report, 11)
+WIRE_SIZE(mess_policy, 5 + 8 * NUM_CHANNELS)
+
+// sink: broadcast
+WIRE_DISTINCT(mess_sensor_node, mess_registration)
+// sink: unicast, the rejoin is recognised before the sender
+WIRE_DISTINCT(mess_rejoin, mess_alive)
+WIRE_DISTINCT(mess_rejoin, actuator_status)
+WIRE_DISTINCT(mess_rejoin, mess_sensor_node)
+WIRE_DISTINCT(mess_rejoin, mess_sensor_fault)
+WIRE_DISTINCT(mess_alive, actuator_status)
+WIRE_DISTINCT(mess_sensor_node, mess_sensor_fault)
+// sensor node and actuator: replies to the registration, reports of the sink
+WIRE_DISTINCT(mess_registration_resp, mess_registry_full)
+WIRE_DISTINCT(mess_registration_resp, mess_link_report)
+WIRE_DISTINCT(mess_registration_resp, mess_to_actuator)	// a late reply must not be taken for a command
+WIRE_DISTINCT(mess_to_actuator, mess_link_report)
+WIRE_DISTINCT(mess_to_actuator, mess_policy)
+WIRE_DISTINCT(mess_link_report, mess_policy)
+
+#endif /* STRUCTURES_H_ */
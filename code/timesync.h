@@ -0,0 +1,60 @@
+#ifndef TIMESYNC_H_
+#define TIMESYNC_H_
+
+/*
+	Lightweight time synchronisation with the sink.
+	The sink puts its clock_time() in the registration reply and in the other frames it sends to a node:
+	the node keeps the offset from the last of them and estimates the drift of its clock over a longer
+	baseline, so that it can convert its own times to the timeline of the sink.
+*/
+
+#include "contiki.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMESYNC_MIN_BASELINE (300 * CLOCK_SECOND)	// minimum time between two points used for the drift
+#define TIMESYNC_WEIGHT 4	// EWMA weight of a new drift sample is 1/TIMESYNC_WEIGHT
+
+struct timesync {
+	bool synced;
+	clock_time_t local;	// local time of the last sync
+	uint32_t sink;	// sink time at the last sync
+	clock_time_t drift_local;	// point used to measure the drift
+	uint32_t drift_sink;
+	bool drift_valid;
+	int32_t drift;	// ppm: the clock of the sink is faster than the local one by this amount
+};
+
+static void timesync_reset(struct timesync *ts) {
+	ts->synced = false;
+	ts->drift_valid = false;
+	ts->drift = 0;
+}
+
+// Called when a frame carrying the clock of the sink arrives
+static void timesync_update(struct timesync *ts, uint32_t sink_time) {
+	clock_time_t now = clock_time();
+	if(ts->synced == false) {
+		ts->drift_local = now;
+		ts->drift_sink = sink_time;
+	} else if(now - ts->drift_local >= TIMESYNC_MIN_BASELINE) {
+		int64_t local_elapsed = (int64_t)(now - ts->drift_local);
+		int64_t sink_elapsed = (int64_t)(int32_t)(sink_time - ts->drift_sink);
+		int32_t sample = (int32_t)((sink_elapsed - local_elapsed) * 1000000 / local_elapsed);
+		ts->drift = ts->drift_valid ? ts->drift + (sample - ts->drift) / TIMESYNC_WEIGHT : sample;
+		ts->drift_valid = true;
+		ts->drift_local = now;
+		ts->drift_sink = sink_time;
+	}
+	ts->local = now;
+	ts->sink = sink_time;
+	ts->synced = true;
+}
+
+// Converts a local time to the timeline of the sink (only if synced)
+static inline uint32_t timesync_to_sink(const struct timesync *ts, clock_time_t local_time) {
+	int32_t elapsed = (int32_t)(local_time - ts->local);
+	return ts->sink + elapsed + (int32_t)((int64_t)elapsed * ts->drift / 1000000);
+}
+
+#endif /* TIMESYNC_H_ */
@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# RAM and flash used by a firmware of the orchard, module by module, and how many sensor nodes
+# the registry of the sink can hold in a RAM budget.
+#
+# usage: tools/footprint.sh <firmware> [RAM budget in bytes]
+#   firmware: the ELF built by Contiki-NG (e.g. code/build/cc26x0-cc13x0/launchpad/cc2650/sink.cc26x0-cc13x0),
+#   its objects are in the obj directory next to it. The budget defaults to the 20 KB of the CC2650.
+#   SIZE and NM select the binutils (arm-none-eabi-size and arm-none-eabi-nm by default)
+#
+# The modules are measured on their objects, before the linker drops the unused sections:
+# the total line is measured on the firmware.
+
+SIZE=${SIZE:-arm-none-eabi-size}
+NM=${NM:-arm-none-eabi-nm}
+APPS="sink sensor actuator"
+
+if [ $# -lt 1 ] || [ ! -f "$1" ]; then
+	echo "usage: $0 <firmware> [RAM budget in bytes]" >&2
+	exit 1
+fi
+elf=$1
+budget=${2:-20480}
+obj=$(dirname "$elf")/obj
+app=$(basename "$elf")
+app=${app%%.*}
+conf=$(dirname "$0")/../code/project-conf.h
+
+# size (Berkeley format): flash = text + data, RAM = data + bss
+printf '%-28s %8s %8s\n' module flash ram
+for o in "$obj"/*.o; do
+	name=$(basename "$o" .o)
+	# the objects of the other firmwares are in the same directory
+	case " $APPS " in
+		*" $name "*) [ "$name" = "$app" ] || continue ;;
+	esac
+	"$SIZE" "$o" | awk -v name="$name" 'NR > 1 { printf "%-28s %8d %8d\n", name, $1 + $2, $2 + $3 }'
+done | sort -k3 -n -r
+"$SIZE" "$elf" | awk 'NR > 1 { printf "%-28s %8d %8d\n", "total", $1 + $2, $2 + $3 }'
+
+[ "$app" = sink ] || exit 0
+
+# Registry: the sensor_nodes array, the neighbour tables of the netstack (MAX_SENSOR_NODES + 1 entries)
+# and the counters of the senders of frame-auth.h (MAX_SENSOR_NODES + 1 + ADMISSION_ENTRIES entries)
+max=$(awk '$1 == "#define" && $2 == "MAX_SENSOR_NODES" { print $3 }' "$conf")
+admission=$(awk '$1 == "#define" && $2 == "ADMISSION_ENTRIES" { print $3 }' "$conf")
+"$NM" -S "$elf" | awk -v max="$max" -v admission="${admission:-0}" -v budget="$budget" -v ram="$("$SIZE" "$elf" | awk 'NR > 1 { print $2 + $3 }')" '
+	function hex(s,    n, i) {
+		n = 0
+		for(i = 1; i <= length(s); i++)
+			n = n * 16 + index("0123456789abcdef", tolower(substr(s, i, 1))) - 1
+		return n
+	}
+	NF == 4 { size = hex($2) }
+	NF == 4 && $4 == "sensor_nodes" { registry += size }
+	NF == 4 && $4 == "frame_auth_senders" { senders += size }
+	NF == 4 && ($4 == "nbr_table_keys" || ($4 ~ /^_.*_mem$/ && $4 !~ /_memb_mem$/)) { neighbours += size }
+	END {
+		if(max == "" || registry == 0) {
+			print "sensor_nodes not found: is the firmware stripped?" > "/dev/stderr"
+			exit 1
+		}
+		entry = registry / max
+		neighbour = neighbours / (max + 1)
+		sender = senders / (max + 1 + admission)
+		fixed = ram - registry - neighbours - senders
+		capacity = int((budget - fixed - neighbour - sender * (1 + admission)) / (entry + neighbour + sender))
+		if(capacity < 0)
+			capacity = 0
+		if(capacity > 65535)	# slot of the messages
+			capacity = 65535
+		printf "\nregistry: %d sensor nodes, %d bytes each + %d bytes of neighbour tables + %d bytes of frame counters\n", max, entry, neighbour, sender
+		printf "RAM without the registry: %d bytes\n", fixed
+		printf "MAX_SENSOR_NODES that fit in %d bytes of RAM: %d\n", budget, capacity
+	}'
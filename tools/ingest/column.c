@@ -0,0 +1,103 @@
+#include "column.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int column_map(struct column *c, size_t size) {
+	int prot = c->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+	void *base = mmap(NULL, size, prot, MAP_SHARED, c->fd, 0);
+	if(base == MAP_FAILED)
+		return -1;
+	c->header = base;
+	c->mapped = size;
+	return 0;
+}
+
+int column_open(struct column *c, const char *path, uint32_t elem_size, bool writable) {
+	struct stat st;
+	c->header = NULL;
+	c->writable = writable;
+	c->fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if(c->fd < 0)
+		return -1;
+	if(fstat(c->fd, &st) < 0)
+		goto fail;
+	if(st.st_size == 0) {
+		// New column
+		if(writable == false)
+			goto fail;
+		if(ftruncate(c->fd, sizeof(struct column_header) + (size_t)elem_size * COLUMN_MIN_ELEMS) < 0)
+			goto fail;
+		if(fstat(c->fd, &st) < 0 || column_map(c, st.st_size) < 0)
+			goto fail;
+		c->header->magic = COLUMN_MAGIC;
+		c->header->elem_size = elem_size;
+		c->header->count = 0;
+		return 0;
+	}
+	if((size_t)st.st_size < sizeof(struct column_header) || column_map(c, st.st_size) < 0)
+		goto fail;
+	// A file of another kind, or written by a different version of the tool (a reader clamps the count, see column_count())
+	if(c->header->magic != COLUMN_MAGIC || c->header->elem_size != elem_size ||
+		(writable && sizeof(struct column_header) + c->header->count * elem_size > c->mapped)) {
+		column_close(c);
+		return -1;
+	}
+	return 0;
+fail:
+	close(c->fd);
+	c->fd = -1;
+	return -1;
+}
+
+void column_close(struct column *c) {
+	if(c->header != NULL)
+		munmap(c->header, c->mapped);
+	if(c->fd >= 0)
+		close(c->fd);
+	c->header = NULL;
+	c->fd = -1;
+}
+
+// Doubles the file and maps it again. If it fails the column keeps its old mapping
+static int column_grow(struct column *c) {
+	struct column_header *old = c->header;
+	size_t old_size = c->mapped;
+	size_t size = c->mapped * 2;
+	if(ftruncate(c->fd, size) < 0)
+		return -1;
+	// The file may stay bigger than the mapping: the next grow maps it again
+	if(column_map(c, size) < 0)
+		return -1;
+	munmap(old, old_size);
+	return 0;
+}
+
+int column_append(struct column *c, const void *elem) {
+	size_t end;
+	if(c->header == NULL)
+		return -1;
+	end = sizeof(struct column_header) + (c->header->count + 1) * c->header->elem_size;
+	if(end > c->mapped && column_grow(c) < 0)
+		return -1;
+	memcpy(column_at(c, c->header->count), elem, c->header->elem_size);
+	c->header->count++;
+	return 0;
+}
+
+uint64_t column_lower_bound(const struct column *c, int64_t key) {
+	uint64_t low = 0, high = column_count(c);
+	while(low < high) {
+		uint64_t mid = low + (high - low) / 2;
+		int64_t value;
+		memcpy(&value, column_at(c, mid), sizeof(value));
+		if(value < key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
@@ -0,0 +1,66 @@
+#ifndef COLUMN_H_
+#define COLUMN_H_
+
+/*
+	Append-only column of fixed size elements, in a memory-mapped file.
+	The file starts with a header (element size and count) followed by the elements:
+	the file grows by doubling, so an append costs a copy in memory most of the times.
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define COLUMN_MAGIC 0x4c4f434fu	// "OCOL"
+#define COLUMN_MIN_ELEMS 1024	// elements of a new file
+
+struct column_header {
+	uint32_t magic;
+	uint32_t elem_size;
+	uint64_t count;
+};
+
+struct column {
+	int fd;
+	struct column_header *header;	// start of the mapping
+	size_t mapped;	// bytes mapped (size of the file)
+	bool writable;
+};
+
+// Opens (and creates, if writable) a column. Returns 0, -1 on error
+int column_open(struct column *c, const char *path, uint32_t elem_size, bool writable);
+void column_close(struct column *c);
+int column_append(struct column *c, const void *elem);
+
+/*
+	Elements of the column. A reader can see the count of a writer that has grown the file
+	after it has been mapped: only the elements inside the mapping are counted
+*/
+static inline uint64_t column_count(const struct column *c) {
+	uint64_t mapped;
+	if(c->header == NULL)
+		return 0;
+	mapped = (c->mapped - sizeof(struct column_header)) / c->header->elem_size;
+	return c->header->count < mapped ? c->header->count : mapped;
+}
+
+// Drops the elements after the first count (e.g. left by an append that has been interrupted)
+static inline void column_truncate(struct column *c, uint64_t count) {
+	if(c->header != NULL && c->writable && count < c->header->count)
+		c->header->count = count;
+}
+
+static inline void *column_at(const struct column *c, uint64_t i) {
+	return (uint8_t*)(c->header + 1) + i * c->header->elem_size;
+}
+
+// Last element, NULL if the column is empty
+static inline void *column_last(const struct column *c) {
+	uint64_t count = column_count(c);
+	return count > 0 ? column_at(c, count - 1) : NULL;
+}
+
+// Index of the first element whose first field (int64_t, sorted) is >= key
+uint64_t column_lower_bound(const struct column *c, int64_t key);
+
+#endif /* COLUMN_H_ */
@@ -0,0 +1,256 @@
+/*
+	Ingest tool of the orchard: stores the output of the sink in a time-series store and answers range queries on it.
+
+	ingest run <store> [device|-] [-b base]
+		reads the serial output of the sink (a tty, set to 115200 baud, or the standard input with "-").
+		The readings and the events are stored with the time of the host, or with base + TIMESTAMP
+		when a saved log is replayed (base: seconds since the epoch of the start of the sink)
+	ingest query <store> <node> <channel> <from> <to> [raw|1m|1h|1d]
+		aggregates a channel of a node over [from, to), with a row for each reading or rollup
+	ingest events <store> <node> <from> <to>
+		lists the commands and the faults of a node ("actuator" for the actuator) in [from, to)
+
+	The times are seconds since the epoch, "now" or a negative time relative to now (e.g. -3600 -> one hour ago)
+*/
+
+#include "parser.h"
+#include "store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define READ_CHUNK 4096
+#define QUERY_MAX_ROWS 500	// rows of a query without a resolution: the finest resolution that fits is used
+#define QUERY_RAW_RANGE 3600	// ranges up to this length (seconds) are answered with the raw readings
+
+struct ingest {
+	struct store store;
+	bool replay;	// time = base + TIMESTAMP, otherwise the time of the host
+	int64_t base;
+	unsigned long readings;
+	unsigned long events;
+	unsigned long errors;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+	(void)sig;
+	stop = 1;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"usage: ingest run <store> [device|-] [-b base]\n"
+		"       ingest query <store> <node> <channel> <from> <to> [raw|1m|1h|1d]\n"
+		"       ingest events <store> <node> <from> <to>\n");
+}
+
+static int64_t now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool parse_time(const char *s, int64_t *t) {
+	char *end;
+	long long value;
+	if(strcmp(s, "now") == 0) {
+		*t = time(NULL);
+		return true;
+	}
+	value = strtoll(s, &end, 10);
+	if(end == s || *end != '\0')
+		return false;
+	*t = value < 0 ? (int64_t)time(NULL) + value : value;
+	return true;
+}
+
+static void on_record(const struct parsed *p, void *ctx) {
+	struct ingest *in = ctx;
+	int64_t t = in->replay ? in->base + (int64_t)p->timestamp : (int64_t)time(NULL);
+	int err;
+	if(p->kind == parsed_reading) {
+		// The reading has been sampled before it has been printed
+		if(p->sampled && p->sampled_at <= p->timestamp)
+			t -= (int64_t)(p->timestamp - p->sampled_at);
+		err = store_add_reading(&in->store, p->node, t, p->values);
+		in->readings++;
+	} else {
+		err = store_add_event(&in->store, p->node, t, p->event, p->arg);
+		in->events++;
+	}
+	if(err < 0)
+		in->errors++;
+}
+
+// Serial port of the sink: raw, 115200 baud
+static int set_tty(int fd) {
+	struct termios tio;
+	if(tcgetattr(fd, &tio) < 0)
+		return -1;
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, B115200);
+	cfsetospeed(&tio, B115200);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	return tcsetattr(fd, TCSANOW, &tio);
+}
+
+static int cmd_run(int argc, char **argv) {
+	static struct ingest in;
+	static struct parser parser;
+	const char *device = "-";
+	char buf[READ_CHUNK];
+	struct sigaction sa;
+	int fd = STDIN_FILENO;
+	for(int i = 3; i < argc; i++) {
+		if(strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			if(parse_time(argv[++i], &in.base) == false) {
+				usage();
+				return 1;
+			}
+			in.replay = true;
+		} else {
+			device = argv[i];
+		}
+	}
+	if(strcmp(device, "-") != 0) {
+		fd = open(device, O_RDONLY | O_NOCTTY);
+		if(fd < 0) {
+			fprintf(stderr, "ingest: %s: %s\n", device, strerror(errno));
+			return 1;
+		}
+		if(isatty(fd) && set_tty(fd) < 0)
+			fprintf(stderr, "ingest: %s: can't set the serial port: %s\n", device, strerror(errno));
+	}
+	if(store_open(&in.store, argv[2], true) < 0) {
+		fprintf(stderr, "ingest: can't open the store %s\n", argv[2]);
+		return 1;
+	}
+	// The store is closed on SIGINT and SIGTERM: the read is interrupted (no SA_RESTART)
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	parser_init(&parser, on_record, &in);
+	while(stop == 0) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			break;
+		parser_feed(&parser, buf, (size_t)n);
+	}
+	store_close(&in.store);
+	if(fd != STDIN_FILENO)
+		close(fd);
+	fprintf(stderr, "ingest: %lu readings, %lu events, %lu lines ignored, %lu errors\n",
+		in.readings, in.events, parser.ignored, in.errors);
+	return in.errors > 0;
+}
+
+static void print_aggregate(int64_t start, const struct aggregate *a) {
+	printf("%lld %u %d %d %.2f\n", (long long)start, a->count, a->min, a->max,
+		a->count > 0 ? (double)a->sum / a->count : 0.0);
+}
+
+static void on_row(int64_t start, const struct aggregate *value, void *ctx) {
+	(void)ctx;
+	print_aggregate(start, value);
+}
+
+static int cmd_query(int argc, char **argv) {
+	static struct store store;
+	struct node_store *n;
+	struct aggregate total;
+	int64_t from, to, start;
+	int channel = -1, resolution = -1;
+	if(argc < 7 || parse_time(argv[5], &from) == false || parse_time(argv[6], &to) == false) {
+		usage();
+		return 1;
+	}
+	for(int c = 0; c < NUM_INGEST_CHANNELS; c++) {
+		if(strcmp(argv[4], channel_labels[c]) == 0)
+			channel = c;
+	}
+	if(channel < 0) {
+		fprintf(stderr, "ingest: unknown channel %s\n", argv[4]);
+		return 1;
+	}
+	if(argc > 7) {
+		for(int r = 0; r < NUM_RESOLUTIONS; r++) {
+			if(strcmp(argv[7], resolution_names[r]) == 0)
+				resolution = r;
+		}
+		if(resolution < 0 && strcmp(argv[7], "raw") != 0) {
+			fprintf(stderr, "ingest: unknown resolution %s\n", argv[7]);
+			return 1;
+		}
+	} else if(to - from > QUERY_RAW_RANGE) {
+		resolution = NUM_RESOLUTIONS - 1;
+		for(int r = 0; r < NUM_RESOLUTIONS; r++) {
+			if((to - from) / resolution_seconds[r] <= QUERY_MAX_ROWS) {
+				resolution = r;
+				break;
+			}
+		}
+	}
+	if(store_open(&store, argv[2], false) < 0 || (n = store_node(&store, argv[3])) == NULL) {
+		fprintf(stderr, "ingest: no data for the node %s\n", argv[3]);
+		return 1;
+	}
+	start = now_ms();
+	total = store_query(n, channel, from, to, resolution, on_row, NULL);
+	printf("# total ");
+	print_aggregate(from, &total);
+	printf("# %s resolution, %lld ms\n", resolution < 0 ? "raw" : resolution_names[resolution], (long long)(now_ms() - start));
+	store_close(&store);
+	return 0;
+}
+
+static void on_event(const struct event *e, void *ctx) {
+	(void)ctx;
+	if(e->kind >= 0 && e->kind < NUM_INGEST_EVENTS)
+		printf("%lld %s %d\n", (long long)e->time, event_names[e->kind], e->arg);
+}
+
+static int cmd_events(int argc, char **argv) {
+	static struct store store;
+	struct node_store *n;
+	int64_t from, to;
+	if(argc < 6 || parse_time(argv[4], &from) == false || parse_time(argv[5], &to) == false) {
+		usage();
+		return 1;
+	}
+	if(store_open(&store, argv[2], false) < 0 || (n = store_node(&store, argv[3])) == NULL) {
+		fprintf(stderr, "ingest: no data for the node %s\n", argv[3]);
+		return 1;
+	}
+	store_events(n, from, to, on_event, NULL);
+	store_close(&store);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if(argc < 3) {
+		usage();
+		return 1;
+	}
+	if(strcmp(argv[1], "run") == 0)
+		return cmd_run(argc, argv);
+	if(strcmp(argv[1], "query") == 0)
+		return cmd_query(argc, argv);
+	if(strcmp(argv[1], "events") == 0)
+		return cmd_events(argc, argv);
+	usage();
+	return 1;
+}
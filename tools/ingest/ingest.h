@@ -0,0 +1,68 @@
+#ifndef INGEST_H_
+#define INGEST_H_
+
+/*
+	Definitions shared by the modules of the ingest tool, that stores the output of the sink
+	(readings, commands and faults) and answers range queries on it.
+*/
+
+#include <stdint.h>
+
+/*
+	Channels printed by the sink for each reading, in the order of SENSOR_CHANNELS (code/structures.h):
+	X(label printed by the sink). Add a line here when a channel is added to the firmware
+*/
+#define INGEST_CHANNELS(X) \
+	X(temperature) \
+	X(humidity) \
+	X(light) \
+	X(battery)
+
+#define INGEST_CHANNEL_INDEX(label) ch_##label,
+
+enum ingest_channel {
+	INGEST_CHANNELS(INGEST_CHANNEL_INDEX)
+	NUM_INGEST_CHANNELS
+};
+
+extern const char *const channel_labels[NUM_INGEST_CHANNELS];
+
+/*
+	Events printed by the sink: X(name, text printed by the sink, argument)
+	The argument is the channel for the events of a sensor, the actuator otherwise (0 windows, 1 irrigation, 2 lights)
+*/
+#define INGEST_EVENTS(X) \
+	X(open_windows, "Request to the actuator sent: Open windows", 0) \
+	X(close_windows, "Request to the actuator sent: Close windows", 0) \
+	X(open_irrigation, "Request to the actuator sent: Open irrigation", 1) \
+	X(close_irrigation, "Request to the actuator sent: Close irrigation", 1) \
+	X(lights_on, "Request to the actuator sent: Turn on the lights", 2) \
+	X(lights_off, "Request to the actuator sent: Turn off the lights", 2) \
+	X(windows_broken, "Broken windows.", 0) \
+	X(irrigation_broken, "Broken irrigation.", 1) \
+	X(lights_broken, "Broken lights.", 2) \
+	X(windows_repaired, "Repaired Windows", 0) \
+	X(irrigation_repaired, "Repaired Irrigation", 1) \
+	X(lights_repaired, "Repaired Lights", 2) \
+	X(actuator_inactive, "No activity detected by the actuator", 0) \
+	X(control_handed_back, "The actuator hands back the control", 0) \
+	X(sensor_faulty, "The * sensor is faulty", -1) \
+	X(sensor_suspect, "The * sensor may be broken", -1) \
+	X(sensors_ok, "No more faulty sensors", 0) \
+	X(battery_low, "Change the battery", ch_battery) \
+	X(sensor_inactive, "No activity detected by the sensor node", 0)
+
+#define INGEST_EVENT_INDEX(name, text, arg) ev_##name,
+
+enum ingest_event {
+	INGEST_EVENTS(INGEST_EVENT_INDEX)
+	NUM_INGEST_EVENTS
+};
+
+extern const char *const event_names[NUM_INGEST_EVENTS];
+
+#define NODE_ID_DIGITS 4	// id of a node as printed by the sink ("%02x%02x" of the last two bytes of its address)
+#define NODE_ID_LEN 12	// buffer of an id: a node or ACTUATOR_ID
+#define ACTUATOR_ID "actuator"	// node that receives the events of the actuator
+
+#endif /* INGEST_H_ */
@@ -0,0 +1,155 @@
+#include "parser.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INGEST_CHANNEL_LABEL(label) #label,
+#define INGEST_EVENT_NAME(name, text, arg) #name,
+#define INGEST_EVENT_TEXT(name, text, arg) text,
+#define INGEST_EVENT_ARG(name, text, arg) arg,
+
+const char *const channel_labels[NUM_INGEST_CHANNELS] = { INGEST_CHANNELS(INGEST_CHANNEL_LABEL) };
+const char *const event_names[NUM_INGEST_EVENTS] = { INGEST_EVENTS(INGEST_EVENT_NAME) };
+static const char *const event_texts[NUM_INGEST_EVENTS] = { INGEST_EVENTS(INGEST_EVENT_TEXT) };
+static const int32_t event_args[NUM_INGEST_EVENTS] = { INGEST_EVENTS(INGEST_EVENT_ARG) };
+
+void parser_init(struct parser *p, parser_cb cb, void *ctx) {
+	p->len = 0;
+	p->skipping = false;
+	p->cb = cb;
+	p->ctx = ctx;
+	p->lines = 0;
+	p->ignored = 0;
+}
+
+// Copies the id of the node that follows the prefix: exactly NODE_ID_DIGITS hex digits
+static bool parse_node(const char *line, const char *prefix, char *node) {
+	const char *s = strstr(line, prefix);
+	size_t len = 0;
+	if(s == NULL)
+		return false;
+	s += strlen(prefix);
+	while(isxdigit((unsigned char)s[len]) && len <= NODE_ID_DIGITS)
+		len++;
+	if(len != NODE_ID_DIGITS)
+		return false;
+	memcpy(node, s, len);
+	node[len] = '\0';
+	return true;
+}
+
+// Channel whose label is at the start of s (followed by a space), -1 if none
+static int parse_channel(const char *s) {
+	for(int c = 0; c < NUM_INGEST_CHANNELS; c++) {
+		size_t len = strlen(channel_labels[c]);
+		if(strncmp(s, channel_labels[c], len) == 0 && s[len] == ' ')
+			return c;
+	}
+	return -1;
+}
+
+// Value printed as: label<sep>"value" (sep is ": " for the channels, " " for the time of the sample)
+static bool parse_value(const char *message, const char *label, const char *sep, long *value) {
+	const char *s = message;
+	size_t len = strlen(label), sep_len = strlen(sep);
+	while((s = strstr(s, label)) != NULL) {
+		const char *start = s + len + sep_len + 1;
+		char *end;
+		if(strncmp(s + len, sep, sep_len) == 0 && start[-1] == '"') {
+			*value = strtol(start, &end, 10);
+			return end != start && *end == '"';
+		}
+		s += len;
+	}
+	return false;
+}
+
+static bool parse_reading(const char *message, struct parsed *out) {
+	long value;
+	for(int c = 0; c < NUM_INGEST_CHANNELS; c++) {
+		if(parse_value(message, channel_labels[c], ": ", &value) == false)
+			return false;
+		out->values[c] = (int32_t)value;
+	}
+	out->sampled = parse_value(message, "sampled at", " ", &value);
+	out->sampled_at = out->sampled ? (unsigned long)value : 0;
+	out->kind = parsed_reading;
+	return parse_node(message, "from the sensor node \"", out->node);
+}
+
+// Does the message match the text of the event? A '*' in the text matches the label of a channel
+static bool match_event(const char *message, const char *text, int32_t *channel) {
+	const char *star = strchr(text, '*');
+	if(star == NULL)
+		return strncmp(message, text, strlen(text)) == 0;
+	size_t head = star - text;
+	if(strncmp(message, text, head) != 0)
+		return false;
+	int c = parse_channel(message + head);
+	if(c < 0)
+		return false;
+	*channel = c;
+	return strncmp(message + head + strlen(channel_labels[c]), star + 1, strlen(star + 1)) == 0;
+}
+
+static bool parse_event(const char *message, struct parsed *out) {
+	for(int e = 0; e < NUM_INGEST_EVENTS; e++) {
+		int32_t arg = event_args[e];
+		if(match_event(message, event_texts[e], &arg) == false)
+			continue;
+		out->kind = parsed_event;
+		out->event = e;
+		out->arg = arg;
+		// The events of a sensor node name it, the others are of the actuator
+		if(parse_node(message, "sensor node \"", out->node) || parse_node(message, "sensor node: ", out->node))
+			return true;
+		strcpy(out->node, ACTUATOR_ID);
+		return true;
+	}
+	return false;
+}
+
+bool parse_line(char *line, struct parsed *out) {
+	char *s = strstr(line, "TIMESTAMP: ");
+	char *end;
+	if(s == NULL)
+		return false;
+	s += strlen("TIMESTAMP: ");
+	out->timestamp = strtoul(s, &end, 10);
+	if(end == s)
+		return false;
+	// The sink separates the timestamp with ". ", the other nodes with ", "
+	while(*end == '.' || *end == ',' || *end == ':' || *end == ' ')
+		end++;
+	if(strncmp(end, "Received data:", 14) == 0)
+		return parse_reading(end, out);
+	return parse_event(end, out);
+}
+
+void parser_feed(struct parser *p, const char *data, size_t n) {
+	struct parsed parsed;
+	for(size_t i = 0; i < n; i++) {
+		char ch = data[i];
+		if(ch == '\n' || ch == '\r') {
+			if(p->skipping == false && p->len > 0) {
+				p->line[p->len] = '\0';
+				if(parse_line(p->line, &parsed)) {
+					p->lines++;
+					p->cb(&parsed, p->ctx);
+				} else {
+					p->ignored++;
+				}
+			}
+			p->len = 0;
+			p->skipping = false;
+		} else if(p->skipping == false) {
+			if(p->len == PARSER_LINE_MAX - 1) {
+				p->skipping = true;
+				p->ignored++;
+			} else {
+				p->line[p->len++] = ch;
+			}
+		}
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef PARSER_H_
+#define PARSER_H_
+
+/*
+	Incremental parser of the serial output of the sink.
+	The bytes are collected in a fixed buffer and each complete line is parsed in place:
+	no memory is allocated, a line longer than the buffer is skipped.
+*/
+
+#include "ingest.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PARSER_LINE_MAX 512
+
+enum parsed_kind {
+	parsed_reading,
+	parsed_event
+};
+
+// Line of the sink that carries data
+struct parsed {
+	enum parsed_kind kind;
+	unsigned long timestamp;	// TIMESTAMP of the line (seconds since the sink started)
+	bool sampled;	// the reading carries the time of its sample
+	unsigned long sampled_at;	// on the timeline of the sink (seconds)
+	char node[NODE_ID_LEN];
+	int32_t values[NUM_INGEST_CHANNELS];
+	enum ingest_event event;
+	int32_t arg;
+};
+
+typedef void (*parser_cb)(const struct parsed *p, void *ctx);
+
+struct parser {
+	char line[PARSER_LINE_MAX];
+	size_t len;
+	bool skipping;	// the line is too long, skipped until its end
+	parser_cb cb;
+	void *ctx;
+	unsigned long lines;	// lines with data
+	unsigned long ignored;	// other lines
+};
+
+void parser_init(struct parser *p, parser_cb cb, void *ctx);
+
+// Feeds the bytes read from the sink: cb is called for each complete line with data
+void parser_feed(struct parser *p, const char *data, size_t n);
+
+// Parses a line (NUL terminated, without the newline). Returns false if it carries no data
+bool parse_line(char *line, struct parsed *out);
+
+#endif /* PARSER_H_ */
@@ -0,0 +1,268 @@
+#include "store.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define STORE_RESOLUTION_NAME(name, seconds) #name,
+#define STORE_RESOLUTION_SECONDS(name, seconds) seconds,
+
+const char *const resolution_names[NUM_RESOLUTIONS] = { STORE_RESOLUTIONS(STORE_RESOLUTION_NAME) };
+const int64_t resolution_seconds[NUM_RESOLUTIONS] = { STORE_RESOLUTIONS(STORE_RESOLUTION_SECONDS) };
+
+static void aggregate_add(struct aggregate *a, int32_t value) {
+	if(a->count == 0 || value < a->min)
+		a->min = value;
+	if(a->count == 0 || value > a->max)
+		a->max = value;
+	a->sum += value;
+	a->count++;
+}
+
+static void aggregate_merge(struct aggregate *a, const struct aggregate *b) {
+	if(b->count == 0)
+		return;
+	if(a->count == 0 || b->min < a->min)
+		a->min = b->min;
+	if(a->count == 0 || b->max > a->max)
+		a->max = b->max;
+	a->sum += b->sum;
+	a->count += b->count;
+}
+
+int store_open(struct store *s, const char *path, bool writable) {
+	if(strlen(path) >= STORE_PATH_LEN)
+		return -1;
+	if(writable && mkdir(path, 0755) < 0 && errno != EEXIST)
+		return -1;
+	strcpy(s->path, path);
+	s->writable = writable;
+	s->num_nodes = 0;
+	return 0;
+}
+
+static void node_close(struct node_store *n) {
+	column_close(&n->time);
+	for(int c = 0; c < NUM_INGEST_CHANNELS; c++)
+		column_close(&n->values[c]);
+	for(int r = 0; r < NUM_RESOLUTIONS; r++)
+		column_close(&n->rollups[r]);
+	column_close(&n->events);
+}
+
+void store_close(struct store *s) {
+	for(int i = 0; i < s->num_nodes; i++)
+		node_close(&s->nodes[i]);
+	s->num_nodes = 0;
+}
+
+// The id becomes the name of a directory: only letters and digits
+static bool valid_id(const char *id) {
+	size_t len = strlen(id);
+	if(len == 0 || len >= NODE_ID_LEN)
+		return false;
+	for(size_t i = 0; i < len; i++) {
+		char ch = id[i];
+		if(!((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')))
+			return false;
+	}
+	return true;
+}
+
+static int open_column(struct store *s, struct column *c, const char *id, const char *name, uint32_t elem_size) {
+	char path[STORE_FILE_LEN];
+	snprintf(path, sizeof(path), "%s/%s/%s.col", s->path, id, name);
+	return column_open(c, path, elem_size, s->writable);
+}
+
+// Readings of a node: the time column is written last, a value column can be longer after an interrupted append
+static uint64_t node_readings(const struct node_store *n) {
+	uint64_t count = column_count(&n->time);
+	for(int c = 0; c < NUM_INGEST_CHANNELS; c++) {
+		if(column_count(&n->values[c]) < count)
+			count = column_count(&n->values[c]);
+	}
+	return count;
+}
+
+// Adds a reading to the rollup of its interval, a new rollup starts when the interval changes
+static int update_rollup(struct column *c, int64_t seconds, int64_t time, const int32_t *values) {
+	struct rollup *last = column_last(c);
+	int64_t start = time - time % seconds;
+	if(last == NULL || last->start != start) {
+		struct rollup fresh;
+		memset(&fresh, 0, sizeof(fresh));
+		fresh.start = start;
+		if(column_append(c, &fresh) < 0)
+			return -1;
+		last = column_last(c);
+	}
+	for(int ch = 0; ch < NUM_INGEST_CHANNELS; ch++)
+		aggregate_add(&last->channels[ch], values[ch]);
+	return 0;
+}
+
+/*
+	Brings a node back to a consistent state after an interrupted write (e.g. the tool has been killed):
+	the columns are cut to the readings that have been committed, and the last rollup of each resolution
+	is computed again from them (it may miss the last readings)
+*/
+static int node_recover(struct node_store *n) {
+	uint64_t count = node_readings(n);
+	int32_t values[NUM_INGEST_CHANNELS];
+	column_truncate(&n->time, count);
+	for(int c = 0; c < NUM_INGEST_CHANNELS; c++)
+		column_truncate(&n->values[c], count);
+	for(int r = 0; r < NUM_RESOLUTIONS; r++) {
+		struct rollup *last = column_last(&n->rollups[r]);
+		uint64_t from = 0;
+		if(last != NULL) {
+			from = column_lower_bound(&n->time, last->start);
+			column_truncate(&n->rollups[r], column_count(&n->rollups[r]) - 1);
+		}
+		for(uint64_t i = from; i < count; i++) {
+			for(int c = 0; c < NUM_INGEST_CHANNELS; c++)
+				values[c] = *(int32_t*)column_at(&n->values[c], i);
+			if(update_rollup(&n->rollups[r], resolution_seconds[r], *(int64_t*)column_at(&n->time, i), values) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+struct node_store *store_node(struct store *s, const char *id) {
+	char path[STORE_FILE_LEN];
+	struct node_store *n;
+	int err = 0;
+	for(int i = 0; i < s->num_nodes; i++) {
+		if(strcmp(s->nodes[i].id, id) == 0)
+			return &s->nodes[i];
+	}
+	if(s->num_nodes == STORE_MAX_NODES || valid_id(id) == false)
+		return NULL;
+	snprintf(path, sizeof(path), "%s/%s", s->path, id);
+	if(s->writable && mkdir(path, 0755) < 0 && errno != EEXIST)
+		return NULL;
+	n = &s->nodes[s->num_nodes];
+	strcpy(n->id, id);
+	// Every column is set as closed, so that a failure can close all of them
+	n->time.header = NULL;
+	n->time.fd = -1;
+	for(int c = 0; c < NUM_INGEST_CHANNELS; c++)
+		n->values[c] = n->time;
+	for(int r = 0; r < NUM_RESOLUTIONS; r++)
+		n->rollups[r] = n->time;
+	n->events = n->time;
+	err |= open_column(s, &n->time, id, "time", sizeof(int64_t));
+	for(int c = 0; c < NUM_INGEST_CHANNELS; c++)
+		err |= open_column(s, &n->values[c], id, channel_labels[c], sizeof(int32_t));
+	for(int r = 0; r < NUM_RESOLUTIONS; r++) {
+		char name[16];
+		snprintf(name, sizeof(name), "rollup-%s", resolution_names[r]);
+		err |= open_column(s, &n->rollups[r], id, name, sizeof(struct rollup));
+	}
+	err |= open_column(s, &n->events, id, "events", sizeof(struct event));
+	if(err == 0 && s->writable)
+		err = node_recover(n);
+	if(err) {
+		node_close(n);
+		return NULL;
+	}
+	s->num_nodes++;
+	return n;
+}
+
+int store_add_reading(struct store *s, const char *id, int64_t time, const int32_t *values) {
+	struct node_store *n = store_node(s, id);
+	int64_t *last;
+	uint64_t count;
+	if(n == NULL)
+		return -1;
+	// The time column must stay sorted: a reading older than the last one (e.g. the clock of the host went back) takes its time
+	last = column_last(&n->time);
+	if(last != NULL && time < *last)
+		time = *last;
+	// The values first, the time commits the reading: a failed append leaves nothing behind
+	count = column_count(&n->time);
+	for(int c = 0; c < NUM_INGEST_CHANNELS; c++) {
+		column_truncate(&n->values[c], count);
+		if(column_append(&n->values[c], &values[c]) < 0)
+			return -1;
+	}
+	if(column_append(&n->time, &time) < 0)
+		return -1;
+	for(int r = 0; r < NUM_RESOLUTIONS; r++) {
+		if(update_rollup(&n->rollups[r], resolution_seconds[r], time, values) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int store_add_event(struct store *s, const char *id, int64_t time, enum ingest_event kind, int32_t arg) {
+	struct node_store *n = store_node(s, id);
+	struct event e;
+	struct event *last;
+	if(n == NULL)
+		return -1;
+	last = column_last(&n->events);
+	e.time = (last != NULL && time < last->time) ? last->time : time;
+	e.kind = kind;
+	e.arg = arg;
+	return column_append(&n->events, &e);
+}
+
+// Raw readings of [from, to)
+static void query_raw(struct node_store *n, int channel, int64_t from, int64_t to, struct aggregate *total, store_row_cb row, void *ctx) {
+	uint64_t count = node_readings(n);
+	uint64_t end = column_lower_bound(&n->time, to);
+	if(end > count)
+		end = count;
+	for(uint64_t i = column_lower_bound(&n->time, from); i < end; i++) {
+		struct aggregate one = {0, 0, 0, 0};
+		aggregate_add(&one, *(int32_t*)column_at(&n->values[channel], i));
+		aggregate_merge(total, &one);
+		if(row != NULL)
+			row(*(int64_t*)column_at(&n->time, i), &one, ctx);
+	}
+}
+
+struct aggregate store_query(struct node_store *n, int channel, int64_t from, int64_t to, int resolution, store_row_cb row, void *ctx) {
+	struct aggregate total = {0, 0, 0, 0};
+	int64_t seconds, first, last;
+	uint64_t end;
+	if(from >= to)
+		return total;
+	if(resolution < 0) {
+		query_raw(n, channel, from, to, &total, row, ctx);
+		return total;
+	}
+	// Intervals of the resolution entirely inside the range: [first, last)
+	seconds = resolution_seconds[resolution];
+	first = from - from % seconds;
+	if(first < from)
+		first += seconds;
+	last = to - to % seconds;
+	if(first >= last) {
+		query_raw(n, channel, from, to, &total, NULL, NULL);
+		if(row != NULL && total.count > 0)
+			row(from, &total, ctx);
+		return total;
+	}
+	query_raw(n, channel, from, first, &total, NULL, NULL);
+	end = column_lower_bound(&n->rollups[resolution], last);
+	for(uint64_t i = column_lower_bound(&n->rollups[resolution], first); i < end; i++) {
+		const struct rollup *r = column_at(&n->rollups[resolution], i);
+		aggregate_merge(&total, &r->channels[channel]);
+		if(row != NULL)
+			row(r->start, &r->channels[channel], ctx);
+	}
+	query_raw(n, channel, last, to, &total, NULL, NULL);
+	return total;
+}
+
+void store_events(struct node_store *n, int64_t from, int64_t to, void (*cb)(const struct event *e, void *ctx), void *ctx) {
+	uint64_t end = column_lower_bound(&n->events, to);
+	for(uint64_t i = column_lower_bound(&n->events, from); i < end; i++)
+		cb(column_at(&n->events, i), ctx);
+}
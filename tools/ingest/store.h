@@ -0,0 +1,94 @@
+#ifndef STORE_H_
+#define STORE_H_
+
+/*
+	Time-series store of the orchard, one directory for each node with a column for each field:
+	time.col (int64_t, seconds since the epoch, sorted), one int32_t column for each channel,
+	events.col (commands and faults) and the rollups of the readings at each resolution.
+	The rollups are updated as the readings arrive, so that a query on a long range reads
+	a few records instead of every reading.
+*/
+
+#include "column.h"
+#include "ingest.h"
+
+#include <limits.h>
+
+#define STORE_MAX_NODES 64	// nodes open at the same time (each one keeps its files open)
+#define STORE_PATH_LEN 512
+#define STORE_FILE_LEN (STORE_PATH_LEN + NODE_ID_LEN + 32)	// path of a column of a node
+
+// Resolutions of the rollups: X(name, seconds)
+#define STORE_RESOLUTIONS(X) \
+	X(1m, 60) \
+	X(1h, 3600) \
+	X(1d, 86400)
+
+#define STORE_RESOLUTION_INDEX(name, seconds) res_##name,
+
+enum store_resolution {
+	STORE_RESOLUTIONS(STORE_RESOLUTION_INDEX)
+	NUM_RESOLUTIONS
+};
+
+extern const char *const resolution_names[NUM_RESOLUTIONS];
+extern const int64_t resolution_seconds[NUM_RESOLUTIONS];
+
+// Aggregate of the values of a channel
+struct aggregate {
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+	int64_t sum;
+};
+
+// Rollup of the readings of a node in [start, start + resolution)
+struct rollup {
+	int64_t start;
+	struct aggregate channels[NUM_INGEST_CHANNELS];
+};
+
+struct event {
+	int64_t time;
+	int32_t kind;	// enum ingest_event
+	int32_t arg;
+};
+
+struct node_store {
+	char id[NODE_ID_LEN];
+	struct column time;
+	struct column values[NUM_INGEST_CHANNELS];
+	struct column rollups[NUM_RESOLUTIONS];
+	struct column events;
+};
+
+struct store {
+	char path[STORE_PATH_LEN];
+	bool writable;
+	struct node_store nodes[STORE_MAX_NODES];
+	int num_nodes;
+};
+
+int store_open(struct store *s, const char *path, bool writable);
+void store_close(struct store *s);
+
+// Node of the store, opened on the first use. NULL if it can't be opened (or it doesn't exist and the store is read only)
+struct node_store *store_node(struct store *s, const char *id);
+
+int store_add_reading(struct store *s, const char *id, int64_t time, const int32_t *values);
+int store_add_event(struct store *s, const char *id, int64_t time, enum ingest_event kind, int32_t arg);
+
+// Called for each row of a query: a reading (count 1) or a rollup
+typedef void (*store_row_cb)(int64_t start, const struct aggregate *value, void *ctx);
+
+/*
+	Aggregates a channel of a node over [from, to), with the rows at a resolution (-1 -> the raw readings).
+	The rollups are used only where they are entirely inside the range, the raw readings at the edges.
+	Returns the total of the range
+*/
+struct aggregate store_query(struct node_store *n, int channel, int64_t from, int64_t to, int resolution, store_row_cb row, void *ctx);
+
+// Calls cb for each event of a node in [from, to)
+void store_events(struct node_store *n, int64_t from, int64_t to, void (*cb)(const struct event *e, void *ctx), void *ctx);
+
+#endif /* STORE_H_ */